@@ -1,4 +1,6 @@
+#include <cppcsv/csvdecompress.hpp>
 #include <cppcsv/csvparser.hpp>
+#include <cppcsv/csvsource.hpp>
 #include <cppcsv/csvwriter.hpp>
 
 #include <cstdio>
@@ -18,18 +20,10 @@ using boost::lexical_cast;
 static void usage( char** argv )
 {
    cerr << "USAGE: " << argv[0] << " input1.csv input2.csv input3.csv ..." << endl;
+   cerr << "Input files can be gzip (or, if built with zstd, zstd) compressed" << endl;
 }
 
 
-class FileCloser
-{
-   FILE* fp;
-public:
-   FileCloser(FILE * fp) : fp(fp) {}
-   ~FileCloser() { fclose(fp); }
-};
-
-
 class OutputFile
 {
    uint64_t pos;
@@ -141,17 +135,9 @@ int main(int argc, char **argv)
       writer.cell("Value", 5);
       writer.end_row();
 
-      const size_t bufsize = 64*1024;
-      char buffer[bufsize];
-
       for (int arg = 1; arg < argc; ++arg)
       {
          string filename = argv[arg];
-         FILE* fp = fopen(filename.c_str(), "rb");
-         if (!fp)
-            throw runtime_error("Could not open file " + filename);
-         FileCloser closer(fp);
-
          ConvertBuilder builder(filename, writer);
 
          cppcsv::csv_parser<ConvertBuilder, char, char, char> parser(
@@ -164,27 +150,18 @@ int main(int argc, char **argv)
                true,    // comments must be at the start
                true     // always collect error context
                );
-
-         while (!feof(fp))
-         {
-            size_t n = fread(buffer, 1, bufsize, fp);
-
-            if (!feof(fp) && ferror(fp))
-               throw runtime_error("Error reading from file " + filename);
-
-            const char* cursor = buffer;
-            if (parser.process(cursor, n))
-               throw runtime_error(
-                     string("Error reading CSV ") 
-                     + filename
-                     + "\n" 
-                     + parser.error() 
-                     + "\n"
-                     + "Context:\n" 
-                     + parser.error_context()
-                     );
-         }
-         // note: no need for final flush, will be done when last read of zero
+         parser.set_zero_copy(true);   // cells are written out straight from the read buffer
+
+         if (cppcsv::parse_compressed_file(parser, filename.c_str()))
+            throw runtime_error(
+                  string("Error reading CSV ") 
+                  + filename
+                  + "\n" 
+                  + parser.error() 
+                  + "\n"
+                  + "Context:\n" 
+                  + parser.error_context()
+                  );
       }
    }
    catch (runtime_error & err) {
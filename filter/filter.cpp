@@ -2,7 +2,15 @@
 #  define _FILE_OFFSET_BITS 64
 #endif
 
+#include <cppcsv/csvdecompress.hpp>
+#include <cppcsv/csvpardecompress.hpp>
 #include <cppcsv/csvparser.hpp>
+#ifdef __linux__
+#  include <cppcsv/csvdirect.hpp>
+#endif
+#include <cppcsv/csvprefetch.hpp>
+#include <cppcsv/csvsource.hpp>
+#include <cppcsv/csvtypes.hpp>
 #include <cppcsv/csvwriter.hpp>
 
 #include <cassert>
@@ -31,6 +39,7 @@
 #include <boost/cstdint.hpp>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
 
 using cppcsv::csv_parser;
 using cppcsv::csv_writer;
@@ -56,12 +65,7 @@ using boost::lexical_cast;
 
 
 #ifdef _MSC_VER  // Microsoft C++
-#  define fseek64 _fseeki64
-#  define ftell64 _ftelli64
 #  define snprintf sprintf_s
-#else
-#  define fseek64 fseeko
-#  define ftell64 ftello
 #endif
  
 
@@ -467,65 +471,6 @@ static const char* end( FixedString const& s )
 */
 
 
-class InputFile
-{
-   uint64_t pos;
-   FILE * fp;
-
-   // noncopyable
-   InputFile( InputFile const& );
-   InputFile& operator=( InputFile const& );
-
-public:
-   InputFile( const char* fn ) :
-      pos(0),
-      fp( fopen(fn, "rb") )
-   {
-      if (fp == NULL)
-         throw runtime_error("Could not open input file " + string(fn));
-   }
-
-   ~InputFile()
-   {
-      fclose(fp);
-   }
-
-   uint64_t position() const
-   {
-      return pos;
-   }
-
-   uint64_t size()
-   {
-      int64_t pos = ftell64(fp);
-      fseek64(fp, 0, SEEK_END);
-      int64_t s = ftell64(fp);
-      fseek64(fp, pos, SEEK_SET);
-      return s;
-   }
-
-   size_t read( char * buffer, size_t num )
-   {
-      size_t n = fread(buffer, 1, num, fp);
-      pos += n;
-
-      if (n > 0)
-         return n;
-
-      if (!feof(fp) && ferror(fp))
-      {
-         ostringstream err;
-         err << "Error reading from file at position " << pos;
-         throw runtime_error(err.str());
-      }
-
-	 return 0;
-   }
-};
-
-
-
-
 class OutputFile
 {
    uint64_t pos;
@@ -579,21 +524,9 @@ public:
 
 static double parse_number( const char* str, size_t len )
 {
-   if (len+1 >= 1024)
-      throw runtime_error("Cell too large to parse");
-
-   char temp[1024];
-   memcpy(temp, str, len);
-   temp[len] = '\0';
-
-   const char* begin = temp;
-   const char* end = begin+len;
-
-   char* parsed = const_cast<char*>(end);
-   errno = 0;
-   double val = strtod(begin, &parsed);
-   if (parsed != end || errno)
-      throw runtime_error("Error parsing number '" + string(begin,len) + "'");
+   double val = 0;   // an empty cell is 0
+   if (len != 0 && cppcsv::parse_double(str, len, val))
+      throw runtime_error("Error parsing number '" + string(str,len) + "'");
    return val;
 }
 
@@ -603,13 +536,20 @@ typedef csv_writer< cppcsv::add_dos_cr_out< cppcsv::OutputRef<OutputFile> > > Cs
 
 
 // note: this is NOT derived from csv_builder, so we skip all the virtual calls entirely
-class FilterBuilder : public cppcsv::per_row_tag
+class FilterBuilder : public cppcsv::per_row_span_tag
 {
    ConfigBuilder const& config;
    CsvWriter & out;
    bool first_row;
    vector<size_t> map_header_to_file;
    string filename;
+   bool projection_ready;
+
+   // file column for a config column
+   size_t file_column( size_t col ) const
+   {
+      return config.files_have_header ? map_header_to_file[col] : col;
+   }
 
 public:
    FilterBuilder( ConfigBuilder const& config, CsvWriter & out, string const& filename ) :
@@ -617,6 +557,7 @@ public:
       out(out),
       first_row(true),
       filename(filename),
+      projection_ready(!config.files_have_header),
       comment_char(config.comment_char),
       comment_at_start_only(config.comment_at_start_only)
    {
@@ -632,14 +573,46 @@ public:
    }
 
 
-   void end_full_row( char* buffer, size_t num_cells, const size_t * offsets, size_t file_row )
+   // the file columns we look at, so the parser can skip the rest.
+   // returns false if not known yet (waiting for the header), or already taken
+   bool take_used_columns( vector<size_t> & cols )
+   {
+      if (!projection_ready)
+         return false;
+      projection_ready = false;
+
+      cols.clear();
+      for (size_t i = 0; i != config.exclude_blanks.size(); ++i)
+         cols.push_back( file_column(config.exclude_blanks[i]) );
+      for (size_t i = 0; i != config.exclude_texts.size(); ++i)
+         cols.push_back( file_column(config.exclude_texts[i].first) );
+      for (size_t i = 0; i != config.filter_mins.size(); ++i)
+         cols.push_back( file_column(config.filter_mins[i].first) );
+      for (size_t i = 0; i != config.filter_maxs.size(); ++i)
+         cols.push_back( file_column(config.filter_maxs[i].first) );
+      for (size_t i = 0; i != config.output_order_1.size(); ++i)
+         if (config.output_order_1[i] > 0)   // 0 is BLANK
+            cols.push_back( file_column(config.output_order_1[i]-1) );
+      return !cols.empty();
+   }
+
+
+   // NULL cells have no data pointer
+   static const char* cell_data( cppcsv::cell_span const& cell )
+   {
+      return cell.data ? cell.data : "";
+   }
+
+
+   // cells point into the parser's input chunk (zero-copy), so only valid during this call
+   void end_full_row( const cppcsv::cell_span* cells, size_t num_cells, size_t file_row )
    {
       if (first_row && config.files_have_header)
       {
          // index what we see from the file
-         vector<string> cells;
+         vector<string> headers;
          for (size_t i = 0; i != num_cells; ++i)
-            cells.push_back( string( buffer+offsets[i], offsets[i+1]-offsets[i] ) );
+            headers.push_back( string( cell_data(cells[i]), cells[i].len ) );
 
           size_t num_exp = config.input_headers.size();
 
@@ -653,22 +626,24 @@ public:
             string const& header = config.input_headers[i];
 
             size_t j = 0;
-            for (; j != cells.size(); ++j)
-               if (header == cells[j])
+            for (; j != headers.size(); ++j)
+               if (header == headers[j])
                   break;
 
-            if (j == cells.size())
+            if (j == headers.size())
             {
                ostringstream err;
                err << "Could not find header '" << header << "' in file which has headers:" << endl;
-               for (size_t k = 0; k != cells.size(); ++k)
-                  err << cells[k] << endl;
+               for (size_t k = 0; k != headers.size(); ++k)
+                  err << headers[k] << endl;
 
                throw runtime_error(err.str());
             }
 
             map_header_to_file[i] = j;
          }
+
+         projection_ready = true;
       }
 
       // ignore empty rows
@@ -683,7 +658,7 @@ public:
             size_t col = config.exclude_blanks[i];
             if (config.files_have_header)
                col = map_header_to_file[col];
-            pass = col < num_cells && (offsets[col+1]-offsets[col]) > 0;
+            pass = col < num_cells && cells[col].len > 0;
          }
 
          // exclude texts...
@@ -695,9 +670,8 @@ public:
 
             if (col < num_cells)
             {
-               size_t len = offsets[col+1]-offsets[col];
                string const& ex = config.exclude_texts[i].second;
-               pass = !str_equal(buffer+offsets[col], len, ex.c_str(), ex.size());
+               pass = !str_equal(cell_data(cells[col]), cells[col].len, ex.c_str(), ex.size());
             }
          }
 
@@ -710,9 +684,8 @@ public:
 
             if (col < num_cells)
             {
-               size_t len = offsets[col+1]-offsets[col];
                double thresh = config.filter_mins[i].second;
-               double val = parse_number( buffer+offsets[col], len );
+               double val = parse_number( cell_data(cells[col]), cells[col].len );
                pass = (thresh <= val);
             }
          }
@@ -726,9 +699,8 @@ public:
 
             if (col < num_cells)
             {
-               size_t len = offsets[col+1]-offsets[col];
                double thresh = config.filter_maxs[i].second;
-               double val = parse_number( buffer+offsets[col], len );
+               double val = parse_number( cell_data(cells[col]), cells[col].len );
                pass = (val <= thresh);
             }
          }
@@ -755,7 +727,7 @@ public:
                if (j > 0 && j-1 < num_cells)
                {
                   size_t cell = j-1;
-                  out.cell( buffer+offsets[cell], offsets[cell+1]-offsets[cell] );
+                  out.cell( cell_data(cells[cell]), cells[cell].len );
                }
                else
                   out.cell( NULL, 0 ); // be correct and specify ALL the columns
@@ -837,11 +809,32 @@ void ensure_csv_ok( const char* filename, Parser & parser )
 }
 
 
+static int percent( uint64_t part, uint64_t total )
+{
+   return total ? static_cast<int>((100.0*part)/total) : 0;
+}
+
+
+// only the filter knows which columns it needs
+template <class Parser, class Builder>
+void apply_projection( Parser &, Builder & )
+{
+}
+
+template <class Parser>
+void apply_projection( Parser & parser, FilterBuilder & builder )
+{
+   vector<size_t> cols;
+   if (builder.take_used_columns(cols))
+      parser.set_projection(cols);
+}
+
+
 // returns file size
 // out is used for printing output file position
 static uint64_t discover_csv_file( const char* filename )
 {
-   InputFile in(filename);
+   cppcsv::file_source in(filename);
    cout << "Found file: " << filename << "  " << (in.size()/1024/1024) << " MB" << endl;
    return in.size();
 }
@@ -862,40 +855,74 @@ uint64_t parse_csv_file( const char* filename, Builder & builder, OutputFile con
          true
          );   // always collect error context
 
-   static const size_t buffer_size = 64*1024;   // 64k buffer
-   vector<char> buffer_vec(buffer_size);	// alloc in heap
-   char * buffer = &buffer_vec[0];
-
-   InputFile in(filename);
-   uint64_t in_size = in.size();
+   parser.set_zero_copy(true);   // cells come straight from the read buffer
+   apply_projection(parser, builder);
+
+   boost::scoped_ptr<cppcsv::input_source> file;
+   boost::scoped_ptr<cppcsv::decompress_source> unzip;
+   boost::scoped_ptr<cppcsv::prefetch_source> prefetch;
+   boost::scoped_ptr<cppcsv::parallel_decompress_source> parallel;
+   const char* mapped = NULL;
+   bool read_ahead = false;
+#ifdef __linux__
+   // bulk scans that should leave the page cache alone
+   struct stat sb;
+   if (getenv("CSV_FILTER_DIRECT_IO") && stat(filename, &sb) == 0 && S_ISREG(sb.st_mode))
+      file.reset(new cppcsv::direct_file_source(filename, 1024*1024));
+#endif
+   if (!file)
+   {
+      // memory mapped if possible, handed out 1 MB at a time for the progress display
+      cppcsv::file_source* fs = new cppcsv::file_source(filename, 1024*1024);
+      file.reset(fs);
+      // otherwise (eg a pipe) read ahead on another thread while parsing
+      read_ahead = !fs->is_mapped();
+      mapped = fs->mapped_data();
+   }
+   // .gz and .zst files are decompressed as they are read, on the read ahead thread,
+   // or, when mapped, on one thread per core if they are made of many blocks (eg bgzip)
+   unzip.reset(new cppcsv::decompress_source(*file, 1024*1024));
+   if (mapped && unzip->format() != cppcsv::no_compression)
+      parallel.reset(new cppcsv::parallel_decompress_source(mapped, static_cast<size_t>(file->size())));
+   if (!parallel && (read_ahead || unzip->format() != cppcsv::no_compression))
+      prefetch.reset(new cppcsv::prefetch_source(*unzip, 3, 1024*1024));
+   cppcsv::input_source & in = parallel ? static_cast<cppcsv::input_source&>(*parallel)
+      : prefetch ? static_cast<cppcsv::input_source&>(*prefetch) : *unzip;
+   uint64_t in_size = file->size();   // progress is shown through the file, before decompression
    if (out)
-      cout << filename << "  " << (in_size/1024/1024) << " MB" << endl;
+   {
+      cout << filename << "  " << (in_size/1024/1024) << " MB";
+      if (unzip->format() != cppcsv::no_compression)
+         cout << " (" << cppcsv::compression_name(unzip->format()) << ")";
+      cout << endl;
+   }
 
-   if (in_size > 0)
+   // note: in_size is 0 for pipes, they are still read
    {
       try {
          uint64_t print_pos = 0;
          while (true)
          {
-            size_t num_read = in.read(buffer, buffer_size);
+            const char* cursor = NULL;
+            size_t num_read = in.next(cursor);
 
-            uint64_t mb_pos = in.position() / (1024*1024); // integer truncation
-            uint64_t total_mb_pos = (current_in_read + in.position()) / (1024*1024); // integer truncation
+            uint64_t mb_pos = in.raw_position() / (1024*1024); // integer truncation
+            uint64_t total_mb_pos = (current_in_read + in.raw_position()) / (1024*1024); // integer truncation
 
             if (out && (print_pos < mb_pos || num_read == 0))  // every megabyte
             {
                print_pos = mb_pos;
                cout << "\r"
-                  << static_cast<int>((100.0*(current_in_read+in.position())/total_in_size)) << "%"
+                  << percent(current_in_read+in.raw_position(), total_in_size) << "%"
                   << "   " << total_mb_pos << " MB "
                   << " --> " << (out->position()/1024/1024) << " MB (" << builder.get_current_row() << " rows)"
-                  << "    File read: " << mb_pos << " MB, " << static_cast<int>((100.0*in.position())/in_size) << "%, " << parser.get_current_row() << " rows";
+                  << "    File read: " << mb_pos << " MB, " << percent(in.raw_position(), in_size) << "%, " << parser.get_current_row() << " rows";
                cout.flush();
             }
 
-            const char* cursor = buffer;
             parser.process(cursor, num_read);
             ensure_csv_ok( filename, parser );
+            apply_projection(parser, builder);   // once the header has been seen
 
             if (num_read == 0)
                break;
@@ -931,6 +958,9 @@ static void usage( char** argv )
    cerr << "   note: program will automatically scan for input files named input_file_baseN.csv (N is " << MIN_STEP << " to " << MAX_STEP << ")" << endl;
    cerr << endl;
    cerr << "or USAGE: " << argv[0] << " HEADERS input_file1 input_file2 input_file3 ..." << endl;
+   cerr << endl;
+   cerr << "Set CSV_FILTER_DIRECT_IO=1 to read input files with O_DIRECT, keeping them out of the page cache (Linux only)" << endl;
+   cerr << "Input files can be gzip (or, if built with zstd, zstd) compressed, they are decompressed as they are read" << endl;
 }
 
 
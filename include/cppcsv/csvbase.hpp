@@ -3,11 +3,62 @@
 // for size_t
 #include <cstddef>
 
+#include <vector>
+
+// keeps rarely used code out of the per-byte paths
+#if defined(_MSC_VER)
+#  define CPPCSV_NOINLINE __declspec(noinline)
+#elif defined(__GNUC__)
+#  define CPPCSV_NOINLINE __attribute__((noinline))
+#else
+#  define CPPCSV_NOINLINE
+#endif
+
+// for checks that are off unless asked for
+#if defined(__GNUC__)
+#  define CPPCSV_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#  define CPPCSV_UNLIKELY(x) (x)
+#endif
+
 namespace cppcsv {
 
 
    struct per_cell_tag {};
    struct per_row_tag {};
+   struct per_row_span_tag {};   // end_full_row() gets a cell_span per cell, see csv_builder_span
+   struct per_batch_tag {};      // end_full_rows() gets many rows at once, see csv_builder_batch
+
+   // one cell handed to a per_row_span_tag builder
+   // data is NULL for a NULL cell (ie nothing between the separators)
+   struct cell_span {
+      const char* data;
+      size_t len;
+   };
+
+   // the rows handed to a per_batch_tag builder, see csv_builder_batch
+   struct csv_batch {
+      std::vector<char> buffer;            // the cells one after another, can be longer than them
+      std::vector<size_t> cell_offsets;    // num_cells(r)+1 for each row, into buffer
+      std::vector<size_t> row_offsets;     // num_rows()+1, row r's offsets start at cell_offsets[row_offsets[r]]
+      std::vector<size_t> file_rows;       // num_rows(), where each row started
+
+      size_t num_rows() const { return file_rows.size(); }
+      size_t num_cells( size_t r ) const { return row_offsets[r+1] - row_offsets[r] - 1; }
+
+      // row r as end_full_row() would get it: cell c is [offsets(r)[c], offsets(r)[c+1]) in data()
+      const size_t* offsets( size_t r ) const { return &cell_offsets[row_offsets[r]]; }
+      char* data() { return buffer.empty() ? NULL : &buffer[0]; }
+      const char* data() const { return buffer.empty() ? NULL : &buffer[0]; }
+
+      void swap( csv_batch & other )
+      {
+         buffer.swap(other.buffer);
+         cell_offsets.swap(other.cell_offsets);
+         row_offsets.swap(other.row_offsets);
+         file_rows.swap(other.file_rows);
+      }
+   };
 
    /* Discouraging virtual interface to encourage template-based speed.
     * Library users can create their own virtual base class if required.
@@ -55,4 +106,49 @@ public:
   }
 };
 
+
+// Many rows in one call, up to the limits set with csv_parser::set_batch_size(),
+// and never more than one process_chunk() call's worth (what is left is handed over
+// at the end of each chunk, and by flush()).
+// The rows are the parser's own buffers, not a copy of them: the function can take
+// the vectors (batch.swap() with an empty csv_batch, or one it has finished with),
+// eg to hand the batch to another thread, and the parser carries on with whatever is left in batch.
+// The function is called as function(csv_batch & batch)
+
+template <class Function>
+class csv_builder_batch : public per_batch_tag {
+public:
+  Function function;
+
+  csv_builder_batch(Function func) : function(func) {}
+
+  void end_full_rows( csv_batch & batch )
+  {
+    function(batch);
+  }
+};
+
+
+// Same again, but each cell comes as its own pointer and length.
+// With csv_parser::set_zero_copy(true) most cells point straight into
+// the chunk given to process_chunk(), so they are only valid during the call.
+// The function is called as function(cells, num_cells, file_row)
+
+template <class Function>
+class csv_builder_span : public per_row_span_tag {
+public:
+  Function function;
+
+  csv_builder_span(Function func) : function(func) {}
+
+  void end_full_row(
+        const cell_span* cells,  // array[num_cells]
+        size_t num_cells,
+        size_t file_row          // row where these cells started
+        )
+  {
+    function(cells, num_cells, file_row);
+  }
+};
+
 }
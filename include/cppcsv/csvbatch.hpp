@@ -0,0 +1,168 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Collects rows into column-major batches (like Arrow record batches),
+// so the consumer can loop over a whole column at once instead of taking one row at a time:
+//
+//    struct MyBatches {
+//       void batch( cppcsv::record_batch const& b );   // b is reused once this returns
+//    };
+//
+//    MyBatches batches;
+//    cppcsv::columnar_builder<MyBatches> builder(batches, 4096);
+//    cppcsv::csv_parser<cppcsv::columnar_builder<MyBatches> > parser(builder, '"', ',');
+//    parser.set_zero_copy(true);
+//    if (cppcsv::parse_file(parser, "input.csv"))
+//       handle error;
+//    builder.finish();   // the last, part full, batch
+//
+// Each column has one data buffer with all its cells one after another,
+// num_rows+1 offsets into it, and a validity bitmap (bit i, least significant first,
+// is 0 for a NULL cell, ie nothing between the separators).
+// Rows can have different numbers of cells: the batch has num_columns columns, as many as
+// its widest row, and cells missing from shorter rows (all of them, for a blank line) are NULL.
+// columns can be longer than that (wider batches came before), only the first num_columns are this batch's.
+//
+// The cells are copied once, into the column buffers, which are kept from one batch
+// to the next, so after the first few batches nothing is allocated.
+
+#include "csvbase.hpp"
+
+#include <boost/cstdint.hpp>
+
+#include <vector>
+
+namespace cppcsv {
+
+
+struct column_batch {
+   std::vector<char> data;
+   std::vector<size_t> offsets;               // num_rows+1, row i is [offsets[i], offsets[i+1])
+   std::vector<boost::uint8_t> validity;      // a bit per row
+   size_t null_count;
+
+   column_batch() : null_count(0) {}
+
+   bool is_valid( size_t row ) const
+   {
+      return (validity[row >> 3] >> (row & 7)) & 1;
+   }
+
+   // NULL for a NULL cell
+   const char* cell( size_t row, size_t & len ) const
+   {
+      len = offsets[row+1] - offsets[row];
+      if (!is_valid(row))
+         return NULL;
+      return data.empty() ? "" : &data[0] + offsets[row];
+   }
+
+   void clear()
+   {
+      // keeps the memory for the next batch
+      data.clear();
+      offsets.assign(1, 0);
+      validity.clear();
+      null_count = 0;
+   }
+
+   // rows so far, then this one
+   void add( size_t row, const char* p, size_t len )
+   {
+      if ((row & 7) == 0)
+         validity.push_back(0);
+      if (p) {
+         validity.back() |= static_cast<boost::uint8_t>(1 << (row & 7));
+         data.insert(data.end(), p, p + len);
+      }
+      else
+         ++null_count;
+      offsets.push_back(data.size());
+   }
+};
+
+
+struct record_batch {
+   size_t num_rows;
+   size_t num_columns;
+   std::vector<column_batch> columns;   // at least num_columns
+   std::vector<size_t> file_rows;       // where each row started in the file
+
+   record_batch() : num_rows(0), num_columns(0) {}
+};
+
+
+// A per_row_span_tag builder that hands the consumer a record_batch every batch_rows rows:
+//    consumer.batch(record_batch const&)
+template <class Consumer>
+class columnar_builder : public per_row_span_tag {
+   // noncopyable
+   columnar_builder( columnar_builder const& );
+   columnar_builder& operator=( columnar_builder const& );
+
+public:
+   explicit columnar_builder( Consumer & consumer, size_t batch_rows = 4096 ) :
+      consumer(consumer),
+      batch_rows(batch_rows ? batch_rows : 1),
+      num_columns(0)
+   {
+   }
+
+   void end_full_row( const cell_span* cells, size_t num_cells, size_t file_row )
+   {
+      if (num_cells > num_columns)
+         add_columns(num_cells);
+
+      const size_t row = b.num_rows;
+      for (size_t i = 0; i != num_cells; ++i)
+         b.columns[i].add(row, cells[i].data, cells[i].len);
+      for (size_t i = num_cells; i < num_columns; ++i)
+         b.columns[i].add(row, NULL, 0);
+      b.file_rows.push_back(file_row);
+
+      if (++b.num_rows == batch_rows)
+         hand_over();
+   }
+
+   // hands over the rows that did not fill a batch, eg after parser.flush()
+   void finish()
+   {
+      if (b.num_rows != 0)
+         hand_over();
+   }
+
+private:
+   Consumer & consumer;
+   const size_t batch_rows;
+   size_t num_columns;     // in this batch, b.columns can have more (from earlier batches)
+   record_batch b;
+
+   void hand_over()
+   {
+      b.num_columns = num_columns;
+      consumer.batch(b);
+      b.num_rows = 0;
+      b.file_rows.clear();
+      for (size_t i = 0; i != b.columns.size(); ++i)
+         b.columns[i].clear();
+      num_columns = 0;
+   }
+
+   // a row wider than the ones before it, the new columns were NULL until now
+   CPPCSV_NOINLINE void add_columns( size_t n )
+   {
+      if (b.columns.size() < n)
+         b.columns.resize(n);
+      for (size_t i = num_columns; i != n; ++i)
+      {
+         b.columns[i].clear();
+         for (size_t row = 0; row != b.num_rows; ++row)
+            b.columns[i].add(row, NULL, 0);
+      }
+      num_columns = n;
+   }
+};
+
+
+} // namespace cppcsv
@@ -0,0 +1,201 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Everything a csv_parser needs to carry on where it left off, eg after a crash
+// or when a long job is moved to another machine:
+//
+//    // between two process_chunk() calls
+//    cppcsv::csv_checkpoint cp;
+//    if (!parser.get_checkpoint(cp))
+//       write_atomically(checkpoint_file, cp.save() + my_output_position);
+//
+//    // later, in a new process
+//    cppcsv::csv_checkpoint cp;
+//    cp.load(bytes_from_checkpoint_file);
+//    if (parser.restore_checkpoint(cp))
+//       handle error;   // a different dialect
+//    source.seek(cp.input_offset);
+//    ... truncate the output to my_output_position, carry on parsing
+//
+// The checkpoint can be taken in the middle of a row, or even a quoted cell.
+// Cells of an open row that a per-cell builder has already been given are not
+// in the checkpoint (they are part of the output), per-row builders get the
+// whole row from the checkpoint.
+// Restore into a parser with the same dialect and the same kind of builder.
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+namespace cppcsv {
+
+
+struct csv_checkpoint {
+   boost::uint64_t dialect_hash;       // of the parser that made it, see csv_parser::restore_checkpoint()
+   boost::uint64_t input_offset;       // bytes given to process_chunk() before the checkpoint
+
+   // csv_parser
+   boost::uint64_t current_row;
+   boost::uint64_t current_column;
+   std::string current_row_content;    // for error_context()
+   unsigned char state_idx;            // csvFSM::StateIdx
+   std::string token_carry;            // part of a Separator_Token at the end of the last chunk
+
+   // csvFSM::Trans
+   char active_qchar;
+   boost::uint64_t row_file_start_row;
+   std::string cells_buffer;
+   std::string whitespace_state;
+   std::vector<boost::uint64_t> cell_offsets;     // empty if no row is open
+   std::vector<boost::uint64_t> span_offsets;     // per_row_span_tag cells of the open row,
+   std::vector<boost::uint64_t> span_lens;        // offset into cells_buffer or -1 for NULL
+   boost::uint64_t row_view_len;
+   bool skipping;
+   boost::uint64_t skipped_len;
+   boost::uint64_t row_skipped_len;
+   std::string wanted;                 // projection
+   std::string next_wanted;
+   bool projection_changed;
+
+   csv_checkpoint() :
+      dialect_hash(0),
+      input_offset(0),
+      current_row(1),
+      current_column(0),
+      state_idx(0),
+      active_qchar(0),
+      row_file_start_row(1),
+      row_view_len(0),
+      skipping(false),
+      skipped_len(0),
+      row_skipped_len(0),
+      projection_changed(false)
+   {
+   }
+
+   // as bytes, little-endian 64 bit numbers and length-prefixed strings
+   std::string save() const
+   {
+      std::string out(magic(), magic_size);
+      put(out, version);
+      put(out, dialect_hash);
+      put(out, input_offset);
+      put(out, current_row);
+      put(out, current_column);
+      put(out, current_row_content);
+      put(out, state_idx);
+      put(out, token_carry);
+      put(out, static_cast<unsigned char>(active_qchar));
+      put(out, row_file_start_row);
+      put(out, cells_buffer);
+      put(out, whitespace_state);
+      put(out, cell_offsets);
+      put(out, span_offsets);
+      put(out, span_lens);
+      put(out, row_view_len);
+      put(out, skipping);
+      put(out, skipped_len);
+      put(out, row_skipped_len);
+      put(out, wanted);
+      put(out, next_wanted);
+      put(out, projection_changed);
+      return out;
+   }
+
+   // throws std::runtime_error if in is not a checkpoint
+   void load( std::string const& in )
+   {
+      if (in.compare(0, magic_size, magic(), magic_size) != 0)
+         throw std::runtime_error("Not a csv checkpoint");
+
+      size_t pos = magic_size;
+      if (get(in, pos) != version)
+         throw std::runtime_error("Unknown csv checkpoint version");
+
+      csv_checkpoint cp;
+      cp.dialect_hash = get(in, pos);
+      cp.input_offset = get(in, pos);
+      cp.current_row = get(in, pos);
+      cp.current_column = get(in, pos);
+      get(in, pos, cp.current_row_content);
+      cp.state_idx = static_cast<unsigned char>(get(in, pos));
+      get(in, pos, cp.token_carry);
+      cp.active_qchar = static_cast<char>(get(in, pos));
+      cp.row_file_start_row = get(in, pos);
+      get(in, pos, cp.cells_buffer);
+      get(in, pos, cp.whitespace_state);
+      get(in, pos, cp.cell_offsets);
+      get(in, pos, cp.span_offsets);
+      get(in, pos, cp.span_lens);
+      cp.row_view_len = get(in, pos);
+      cp.skipping = get(in, pos) != 0;
+      cp.skipped_len = get(in, pos);
+      cp.row_skipped_len = get(in, pos);
+      get(in, pos, cp.wanted);
+      get(in, pos, cp.next_wanted);
+      cp.projection_changed = get(in, pos) != 0;
+
+      if (pos != in.size())
+         throw std::runtime_error("Corrupt csv checkpoint");
+      *this = cp;
+   }
+
+private:
+   enum { magic_size = 8, version = 2 };
+   static const char* magic() { return "cppcsvck"; }
+
+   static void put( std::string & out, boost::uint64_t v )
+   {
+      for (int i = 0; i != 8; ++i)
+         out.push_back(static_cast<char>(v >> (8*i)));
+   }
+
+   static void put( std::string & out, std::string const& s )
+   {
+      put(out, s.size());
+      out += s;
+   }
+
+   static void put( std::string & out, std::vector<boost::uint64_t> const& v )
+   {
+      put(out, v.size());
+      for (size_t i = 0; i != v.size(); ++i)
+         put(out, v[i]);
+   }
+
+   static boost::uint64_t get( std::string const& in, size_t & pos )
+   {
+      if (in.size() - pos < 8)
+         throw std::runtime_error("Corrupt csv checkpoint");
+      boost::uint64_t v = 0;
+      for (int i = 0; i != 8; ++i)
+         v |= static_cast<boost::uint64_t>(static_cast<unsigned char>(in[pos+i])) << (8*i);
+      pos += 8;
+      return v;
+   }
+
+   static void get( std::string const& in, size_t & pos, std::string & s )
+   {
+      const boost::uint64_t n = get(in, pos);
+      if (n > in.size() - pos)
+         throw std::runtime_error("Corrupt csv checkpoint");
+      s.assign(in, pos, static_cast<size_t>(n));
+      pos += static_cast<size_t>(n);
+   }
+
+   static void get( std::string const& in, size_t & pos, std::vector<boost::uint64_t> & v )
+   {
+      const boost::uint64_t n = get(in, pos);
+      if (n > (in.size() - pos) / 8)
+         throw std::runtime_error("Corrupt csv checkpoint");
+      v.resize(static_cast<size_t>(n));
+      for (size_t i = 0; i != v.size(); ++i)
+         v[i] = get(in, pos);
+   }
+};
+
+
+} // namespace cppcsv
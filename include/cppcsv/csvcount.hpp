@@ -0,0 +1,357 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Counts rows without building any cells, eg for progress estimates or
+// checking a file against a manifest:
+//
+//    cppcsv::file_source in("input.csv");
+//    size_t rows;
+//    if (cppcsv::count_rows(in, cppcsv::csv_dialect<char,char,char>('"', ',', false, false, '#'), rows))
+//       handle error;
+//
+// The count is what a csv_parser with the same dialect would give a builder
+// (comment lines are not rows, blank lines are, quoted newlines are not row ends).
+//
+// Most rows are counted by skipping from one newline or quote to the next
+// with the SIMD scanner (see csvscan.hpp), and from a quote to its closing quote.
+// Anything that needs more care (comment chars, quotes in odd places, a lone CR,
+// a row that continues into the next chunk, errors) is handed to a real csv_parser,
+// from the start of that row until it is between rows again.
+
+#include "csvparser.hpp"
+#include "csvscan.hpp"
+#include "csvsource.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace cppcsv {
+
+namespace count_detail {
+
+   class row_count_builder : public per_cell_tag {
+   public:
+      size_t rows;
+
+      row_count_builder() : rows(0) {}
+
+      void begin_row() {}
+      void cell( const char*, size_t ) {}
+      void end_row() { ++rows; }
+   };
+
+} // namespace count_detail
+
+
+
+template <class QuoteChars = char, class Separators = char, class CommentChars = char>
+class csv_row_counter
+{
+   // disable copy
+   csv_row_counter& operator=(csv_row_counter const&);
+   csv_row_counter(csv_row_counter const&);
+
+public:
+   typedef csv_dialect<QuoteChars,Separators,CommentChars> Dialect;
+
+   // a row boundary, see set_mark_interval()
+   struct row_mark {
+      boost::uint64_t offset;    // in the whole input
+      size_t rows;               // rows before it
+      size_t line;               // file line it is on, for csv_parser::resume_at_row()
+   };
+
+   explicit csv_row_counter( Dialect const& dialect ) :
+      parser(counted, dialect),
+      fast_rows(0),
+      line(1),
+      in_parser(false),
+      chunk_offset(0),
+      chunk_begin(NULL),
+      mark_interval(0),
+      next_mark(size_t(-1))
+   {
+      parser.set_zero_copy(true);   // no need to copy cells that are thrown away
+
+      using namespace csvFSM;
+      for (int i = 0; i != 256; ++i)
+      {
+         const char c = static_cast<char>(i);
+         char_class[i] = parser.char_class_of(c);
+
+         // everything except chars, whitespace and separators needs a look
+         if (char_class[i] != EvChar && char_class[i] != EvWhitespace && char_class[i] != EvSep)
+            unquoted_stops.insert(c);
+
+         if (char_class[i] == EvQchar || char_class[i] == ClassQcharActive)
+         {
+            quote_index[i] = static_cast<unsigned char>(quoted_stops.size());
+            quoted_stops.push_back(scan::byte_set());
+         }
+      }
+
+      // inside quotes, only the quote char that opened the cell matters,
+      // and newlines (to count lines), CRs and NULs
+      for (int q = 0; q != 256; ++q)
+      {
+         if (char_class[q] != EvQchar && char_class[q] != ClassQcharActive)
+            continue;
+         scan::byte_set & stops = quoted_stops[quote_index[q]];
+         stops.insert(static_cast<char>(q));
+         for (int i = 0; i != 256; ++i)
+            if (char_class[i] == EvNewline || char_class[i] == EvDosCR || char_class[i] == ClassNull)
+               stops.insert(static_cast<char>(i));
+      }
+   }
+
+   // NOTE: returns true on error, then buf is at the character that caused the problem
+   bool process_chunk( const char *& buf, size_t len )
+   {
+      const char * const end = buf + len;
+      const char * p = buf;
+      chunk_begin = buf;
+      while (p != end)
+      {
+         if (in_parser)
+         {
+            if (parse_to_row_end(p, end))
+            {
+               buf = p;
+               return true;
+            }
+         }
+         else
+            p = count_fast(p, end);
+      }
+      buf = end;
+      chunk_offset += len;
+      return false;
+   }
+
+   // call this after the last chunk
+   bool flush()
+   {
+      if (in_parser)
+         return parser.flush();
+      return false;
+   }
+
+   // rows seen so far
+   size_t rows() const { return fast_rows + counted.rows; }
+
+   // note: returns NULL if no error
+   const char * error() const { return parser.error(); }
+   std::string error_context() const { return parser.error_context(); }
+
+   size_t get_current_row() const { return in_parser ? parser.get_current_row() : line; }
+
+   // For counting part of the input (see csvindex.hpp), from a row boundary at offset on the given line.
+   // Call before the first chunk.
+   void resume_at( boost::uint64_t offset, size_t at_line )
+   {
+      chunk_offset = offset;
+      line = at_line;
+   }
+
+   // Remember the first row boundary after every n rows (0 for none), see marks().
+   // Call before the first chunk.
+   void set_mark_interval( size_t n )
+   {
+      mark_interval = n;
+      next_mark = n ? n : size_t(-1);
+   }
+
+   std::vector<row_mark> const& marks() const { return row_marks; }
+
+private:
+   count_detail::row_count_builder counted;     // before parser, which keeps a reference to it
+   csv_parser<count_detail::row_count_builder,QuoteChars,Separators,CommentChars> parser;
+
+   unsigned char char_class[256];
+   scan::byte_set unquoted_stops;
+   std::vector<scan::byte_set> quoted_stops;
+   unsigned char quote_index[256];   // into quoted_stops
+
+   size_t fast_rows;
+   size_t line;         // file line at the start of the current row, when not in_parser
+   bool in_parser;      // the parser has the current row
+
+   boost::uint64_t chunk_offset;    // of chunk_begin in the whole input
+   const char* chunk_begin;
+   size_t mark_interval;
+   size_t next_mark;                // rows() to reach for the next mark
+   std::vector<row_mark> row_marks;
+
+   void mark( const char* p, size_t at_line )
+   {
+      row_mark m = { chunk_offset + (p - chunk_begin), rows(), at_line };
+      row_marks.push_back(m);
+      next_mark = rows() + mark_interval;
+   }
+
+   unsigned char cls( char c ) const { return char_class[static_cast<unsigned char>(c)]; }
+
+   // counts rows from p (between rows), returns where the parser has to take over, or end
+   const char* count_fast( const char* p, const char* const end )
+   {
+      using namespace csvFSM;
+
+      const char* row_begin = p;
+      size_t row_lines = 0;      // newlines in quoted cells of this row
+      for (;;)
+      {
+         const char* s = unquoted_stops.find(p, end);
+         if (s == end)
+            break;
+
+         const unsigned char c = cls(*s);
+         if (c == EvNewline || c == EvDosCR)
+         {
+            if (c == EvDosCR)
+            {
+               if (s+1 == end || cls(s[1]) != EvNewline)
+                  break;
+               ++s;
+            }
+            ++fast_rows;
+            line += row_lines + 1;
+            row_lines = 0;
+            p = row_begin = s+1;
+            if (fast_rows + counted.rows >= next_mark)
+               mark(p, line);
+            continue;
+         }
+
+         if (c != EvQchar && c != ClassQcharActive)
+            break;   // comments, NULs
+
+         // a quote starts a quoted cell if there is only whitespace before it in the cell
+         const char* q = s;
+         bool whitespace = false;
+         while (q != row_begin && cls(q[-1]) == EvWhitespace)
+         {
+            --q;
+            whitespace = true;
+         }
+         if (q != row_begin && cls(q[-1]) != EvSep)
+         {
+            if (whitespace)
+               break;   // an error, let the parser report it
+            p = s+1;    // tolerated in the middle of an unquoted cell
+            continue;
+         }
+
+         p = skip_quoted(s, end, row_lines);
+         if (!p)
+            break;
+      }
+
+      if (row_begin != end)
+      {
+         // from the start of this row
+         if (line > 1)
+            parser.resume_at_row(line);
+         in_parser = true;
+      }
+      return row_begin;
+   }
+
+   // s is an opening quote, returns where the cell ends (after a separator, or at the newline),
+   // or NULL if the parser should look at it
+   const char* skip_quoted( const char* s, const char* const end, size_t & row_lines ) const
+   {
+      using namespace csvFSM;
+
+      const char qc = *s;
+      scan::byte_set const& stops = quoted_stops[quote_index[static_cast<unsigned char>(qc)]];
+      const char* p = s+1;
+      for (;;)
+      {
+         const char* t = stops.find(p, end);
+         if (t == end)
+            return NULL;
+
+         if (*t == qc)
+         {
+            if (t+1 == end)
+               return NULL;
+            if (t[1] == qc)
+            {
+               p = t+2;   // escaped quote
+               continue;
+            }
+
+            // the closing quote, then maybe whitespace, then the end of the cell
+            const char* u = t+1;
+            while (u != end && cls(*u) == EvWhitespace)
+               ++u;
+            if (u == end)
+               return NULL;
+            const unsigned char c = cls(*u);
+            if (c == EvSep)
+               return u+1;
+            if (c == EvNewline || c == EvDosCR)
+               return u;
+            return NULL;
+         }
+
+         const unsigned char c = cls(*t);
+         if (c == EvNewline)
+         {
+            ++row_lines;
+            p = t+1;
+         }
+         else if (c == EvDosCR && t+1 != end && cls(t[1]) == EvNewline)
+         {
+            ++row_lines;
+            p = t+2;
+         }
+         else
+            return NULL;   // lone CR, NUL
+      }
+   }
+
+   // runs the parser a line at a time, until it is between rows
+   // NOTE: returns true on error, with p at the character that caused it
+   bool parse_to_row_end( const char *& p, const char* const end )
+   {
+      while (p != end)
+      {
+         const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+         const char* next = nl ? nl+1 : end;
+         const char* cursor = p;
+         if (parser.process_chunk(cursor, next - p))
+         {
+            p = cursor;
+            return true;
+         }
+         p = next;
+         if (nl && parser.at_row_boundary())
+         {
+            in_parser = false;
+            line = parser.get_current_row();
+            if (rows() >= next_mark)
+               mark(p, line);
+            break;
+         }
+      }
+      return false;
+   }
+};
+
+
+
+// counts the rows in source, as a csv_parser with dialect would give them to a builder
+// NOTE: returns true on error, rows is the count up to the error
+template <class QuoteChars, class Separators, class CommentChars>
+bool count_rows( input_source & source, csv_dialect<QuoteChars,Separators,CommentChars> const& dialect, size_t & rows )
+{
+   csv_row_counter<QuoteChars,Separators,CommentChars> counter(dialect);
+   const bool failed = parse_source(counter, source);
+   rows = counter.rows();
+   return failed;
+}
+
+
+} // namespace cppcsv
@@ -0,0 +1,304 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Reads gzip (and, with CPPCSV_HAVE_ZSTD, zstd) compressed input as it goes,
+// with no temporary file:
+//
+//    if (cppcsv::parse_compressed_file(parser, "input.csv.gz"))
+//       handle error;
+//
+// or, to put it together yourself:
+//
+//    cppcsv::file_source file("input.csv.gz");
+//    cppcsv::decompress_source unzip(file);        // looks at the first bytes
+//    cppcsv::prefetch_source in(unzip);            // decompresses on another thread
+//    if (cppcsv::parse_source(parser, in))
+//       handle error;
+//
+// The format is told from the magic bytes at the start, not the file name,
+// and input that is neither is handed out as it is (the wrapped source's own blocks,
+// so a memory mapped file is still zero copy).
+// Concatenated gzip members (eg from cat a.gz b.gz, or pigz/bgzip) and
+// zstd frames are read one after another, as gunzip and zstd -d would.
+//
+// Needs zlib (link with -lz), zstd needs -DCPPCSV_HAVE_ZSTD and -lzstd.
+// Corrupt or truncated input is thrown as std::runtime_error.
+
+#include "csvprefetch.hpp"
+#include "csvsource.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include <zlib.h>
+#ifdef CPPCSV_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
+namespace cppcsv {
+
+
+enum compression {
+   no_compression,
+   gzip_compression,
+   zstd_compression
+};
+
+inline const char* compression_name( compression c )
+{
+   switch (c) {
+      case gzip_compression: return "gzip";
+      case zstd_compression: return "zstd";
+      default: return "none";
+   }
+}
+
+// from the first bytes of the input (4 are enough)
+inline compression detect_compression( const char* data, size_t len )
+{
+   const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+   if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+      return gzip_compression;
+   if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+      return zstd_compression;
+   return no_compression;
+}
+
+
+
+// Decompresses another source (or passes it through), see above.
+class decompress_source : public input_source {
+   // noncopyable
+   decompress_source( decompress_source const& );
+   decompress_source& operator=( decompress_source const& );
+
+public:
+   static const size_t default_block_size = 256*1024;
+
+   // in must outlive this. The first block of in is read here, to see what it is.
+   // block_size: how much decompressed data next() hands out at once
+   explicit decompress_source( input_source & in, size_t block_size = default_block_size ) :
+      in(in),
+      fmt(no_compression),
+      block_size(std::max<size_t>(block_size, 1)),
+      pending(NULL),
+      pending_len(0),
+      in_ended(false),
+      in_frame(true),
+      pos(0)
+#ifdef CPPCSV_HAVE_ZSTD
+      , zstd(NULL)
+#endif
+   {
+      read_head();
+      fmt = detect_compression(pending, pending_len);
+      if (fmt == gzip_compression)
+      {
+         memset(&zs, 0, sizeof(zs));
+         if (inflateInit2(&zs, 15 + 16) != Z_OK)   // gzip header, not zlib's
+            throw std::runtime_error("Could not start gzip decompression");
+      }
+      else if (fmt == zstd_compression)
+      {
+#ifdef CPPCSV_HAVE_ZSTD
+         zstd = ZSTD_createDStream();
+         if (zstd == NULL || ZSTD_isError(ZSTD_initDStream(zstd)))
+         {
+            ZSTD_freeDStream(zstd);
+            throw std::runtime_error("Could not start zstd decompression");
+         }
+#else
+         throw std::runtime_error("Input is zstd compressed, build with CPPCSV_HAVE_ZSTD to read it");
+#endif
+      }
+   }
+
+   ~decompress_source()
+   {
+      if (fmt == gzip_compression)
+         inflateEnd(&zs);
+#ifdef CPPCSV_HAVE_ZSTD
+      ZSTD_freeDStream(zstd);
+#endif
+   }
+
+   compression format() const { return fmt; }
+
+   // decompressed bytes handed out so far
+   boost::uint64_t position() const { return pos; }
+
+   // of the compressed input
+   boost::uint64_t raw_position() const { return in.raw_position() - pending_len; }
+
+   // the decompressed size is not known until the end
+   boost::uint64_t size() const { return fmt == no_compression ? in.size() : 0; }
+
+   size_t next( const char*& data )
+   {
+      if (fmt == no_compression)
+      {
+         size_t n = pending_len;
+         if (n != 0)
+         {
+            // what read_head() looked at
+            data = pending;
+            pending_len = 0;
+         }
+         else
+            n = in.next(data);
+         pos += n;
+         return n;
+      }
+
+      out.resize(block_size);
+      const size_t n = (fmt == gzip_compression) ? gunzip(&out[0], out.size()) : unzstd(&out[0], out.size());
+      data = &out[0];
+      pos += n;
+      return n;
+   }
+
+   // only without compression
+   bool seek( boost::uint64_t offset )
+   {
+      if (fmt != no_compression || !in.seek(offset))
+         return false;
+      pending_len = 0;
+      in_ended = false;
+      pos = offset;
+      return true;
+   }
+
+private:
+   input_source & in;
+   compression fmt;
+   size_t block_size;
+   std::vector<char> out;
+   std::vector<char> head;     // only if in's first blocks were too short to tell
+
+   // what is left of in's last block
+   const char* pending;
+   size_t pending_len;
+   bool in_ended;
+   bool in_frame;              // inside a gzip member or zstd frame, so the input can't end here
+   boost::uint64_t pos;
+
+   z_stream zs;
+#ifdef CPPCSV_HAVE_ZSTD
+   ZSTD_DStream* zstd;
+#endif
+
+   void read_head()
+   {
+      if (!fill() || pending_len >= 4)
+         return;
+      // a pipe can hand out a few bytes at a time
+      head.assign(pending, pending + pending_len);
+      while (head.size() < 4 && fill())
+         head.insert(head.end(), pending, pending + pending_len);
+      pending = &head[0];
+      pending_len = head.size();
+   }
+
+   // the next block of in, false at the end
+   bool fill()
+   {
+      if (!in_ended)
+      {
+         pending_len = in.next(pending);
+         in_ended = (pending_len == 0);
+      }
+      return !in_ended;
+   }
+
+   size_t gunzip( char* dest, size_t n )
+   {
+      zs.next_out = reinterpret_cast<Bytef*>(dest);
+      zs.avail_out = static_cast<uInt>(std::min<size_t>(n, UINT_MAX));
+      const uInt avail = zs.avail_out;
+      while (zs.avail_out != 0)
+      {
+         if (pending_len == 0)
+            fill();
+         if (pending_len == 0 && !in_frame)
+            break;   // the end, between members
+         if (!in_frame)
+         {
+            // another member follows
+            if (inflateReset(&zs) != Z_OK)
+               throw std::runtime_error("Could not restart gzip decompression");
+            in_frame = true;
+         }
+
+         const uInt given = static_cast<uInt>(std::min<size_t>(pending_len, UINT_MAX));
+         zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pending));
+         zs.avail_in = given;
+         const int ret = inflate(&zs, Z_NO_FLUSH);
+         pending += given - zs.avail_in;
+         pending_len -= given - zs.avail_in;
+
+         if (ret == Z_STREAM_END)
+            in_frame = false;
+         else if (ret == Z_BUF_ERROR)
+            throw std::runtime_error("Truncated gzip input");   // no input left, and more was needed
+         else if (ret != Z_OK)
+            throw std::runtime_error(std::string("Corrupt gzip input: ") + (zs.msg ? zs.msg : "inflate failed"));
+      }
+      return avail - zs.avail_out;
+   }
+
+#ifdef CPPCSV_HAVE_ZSTD
+   size_t unzstd( char* dest, size_t n )
+   {
+      ZSTD_outBuffer ob = { dest, n, 0 };
+      while (ob.pos != ob.size)
+      {
+         if (pending_len == 0)
+            fill();
+         if (pending_len == 0 && !in_frame)
+            break;
+
+         ZSTD_inBuffer ib = { pending, pending_len, 0 };
+         const size_t before = ob.pos;
+         const size_t ret = ZSTD_decompressStream(zstd, &ob, &ib);
+         if (ZSTD_isError(ret))
+            throw std::runtime_error(std::string("Corrupt zstd input: ") + ZSTD_getErrorName(ret));
+         pending += ib.pos;
+         pending_len -= ib.pos;
+         in_frame = (ret != 0);   // 0: a frame has just ended
+         if (in_frame && pending_len == 0 && in_ended && ob.pos == before)
+            throw std::runtime_error("Truncated zstd input");
+      }
+      return ob.pos;
+   }
+#else
+   size_t unzstd( char*, size_t )
+   {
+      return 0;   // never gets here, the constructor threw
+   }
+#endif
+};
+
+
+
+// parse_file(), but gzip or zstd files are decompressed on another thread as they are parsed
+// NOTE: returns true on error, like csv_parser
+template <class Parser>
+bool parse_compressed_file( Parser & parser, const char* filename )
+{
+   file_source file(filename);
+   decompress_source unzip(file);
+   if (unzip.format() == no_compression)
+      return parse_source(parser, unzip);
+   prefetch_source in(unzip);
+   return parse_source(parser, in);
+}
+
+
+} // namespace cppcsv
@@ -0,0 +1,452 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Linux only: reads a file around the page cache, for bulk scans of big files
+// that should not push everyone else's data out of memory:
+//
+//    cppcsv::direct_file_source in("huge.csv");
+//    if (cppcsv::parse_source(parser, in))
+//       handle error;
+//
+// The file is opened with O_DIRECT, and read into aligned buffers with
+// io_uring, several blocks in flight at once, so the disk stays busy while
+// the parser works on the block it was given last.
+// io_uring is used through its system calls, liburing is not needed.
+//
+// Falls back, one step at a time, when something is not there:
+//  - no io_uring (old kernel, or blocked eg by seccomp): one pread() at a time,
+//    wrap it in a prefetch_source (csvprefetch.hpp) to get the overlap back.
+//  - no O_DIRECT (eg tmpfs, or a filesystem that takes it at open and then fails
+//    the reads with EINVAL): normal reads, and the pages are dropped from the
+//    cache with posix_fadvise() once the parser is done with them.
+//
+// I/O errors are thrown as std::runtime_error.
+
+#include "csvsource.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace cppcsv {
+
+
+class direct_file_source : public input_source {
+   // noncopyable
+   direct_file_source( direct_file_source const& );
+   direct_file_source& operator=( direct_file_source const& );
+
+public:
+   static const size_t default_block_size = 1024*1024;
+   static const size_t alignment = 4096;   // O_DIRECT needs offsets, lengths and buffers aligned to the device block
+
+   // block_size is rounded up to alignment, queue_depth is the number of blocks in flight
+   explicit direct_file_source( const char* filename, size_t block_size = default_block_size, size_t queue_depth = 4 ) :
+      fd(-1),
+      direct(true),
+      total_size(0),
+      pos(0),
+      next_offset(0),
+      next_read(0),
+      skip(0),
+      block_size((std::max<size_t>(block_size, 1) + alignment-1) / alignment * alignment),
+      handed_out(-1),
+      ring_fd(-1),
+      sq_ring(NULL),
+      cq_ring(NULL),
+      sqes(NULL),
+      sq_ring_size(0),
+      cq_ring_size(0),
+      sqes_size(0),
+      in_flight(0)
+   {
+      fd = open(filename, O_RDONLY | O_DIRECT);
+      if (fd < 0 && errno == EINVAL)
+      {
+         direct = false;
+         fd = open(filename, O_RDONLY);
+      }
+      if (fd < 0)
+         throw std::runtime_error("Could not open input file " + std::string(filename));
+
+      try {
+         struct stat sb;
+         if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode))
+            throw std::runtime_error("Could not open input file (not a regular file?) " + std::string(filename));
+         total_size = sb.st_size;
+         if (!direct)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+         slots.resize(std::max<size_t>(queue_depth, 1));
+         for (size_t i = 0; i != slots.size(); ++i)
+         {
+            void* p = NULL;
+            if (posix_memalign(&p, alignment, this->block_size) != 0)
+               throw std::bad_alloc();
+            slots[i].buf = static_cast<char*>(p);
+         }
+
+         setup_ring();
+         fill_queue();
+      }
+      catch (...) {
+         // the destructor won't run
+         free_all();
+         throw;
+      }
+   }
+
+   ~direct_file_source()
+   {
+      free_all();
+   }
+
+   // false if it fell back to plain reads
+   bool is_direct() const { return direct; }
+   bool uses_io_uring() const { return ring_fd >= 0; }
+
+   boost::uint64_t position() const { return pos; }
+   boost::uint64_t size() const { return total_size; }
+
+   size_t next( const char*& data )
+   {
+      if (handed_out >= 0)
+      {
+         // the parser is done with it
+         slot & done = slots[handed_out];
+         if (!direct)
+            posix_fadvise(fd, done.offset, done.len, POSIX_FADV_DONTNEED);
+         done.state = slot::idle;
+         handed_out = -1;
+      }
+      fill_queue();
+
+      if (next_offset >= total_size)
+         return 0;
+
+      slot & s = slots[find_slot(next_offset)];
+      wait_for(s);
+      if (s.len <= skip)
+         throw std::runtime_error("Error reading from input file (file changed?)");
+
+      next_offset += s.len;
+      handed_out = static_cast<int>(&s - &slots[0]);
+      data = s.buf + skip;
+      const size_t n = s.len - skip;
+      skip = 0;
+      pos += n;
+      return n;
+   }
+
+   bool seek( boost::uint64_t offset )
+   {
+      if (offset > total_size)
+         return false;
+      drain();
+      for (size_t i = 0; i != slots.size(); ++i)
+         slots[i].state = slot::idle;
+      handed_out = -1;
+      next_read = next_offset = (offset == total_size) ? offset : offset / alignment * alignment;
+      skip = static_cast<size_t>(offset - next_offset);
+      pos = offset;
+      fill_queue();
+      return true;
+   }
+
+private:
+   struct slot {
+      enum state_t { idle, reading, done } state;
+      char* buf;
+      boost::uint64_t offset;
+      size_t len;        // read so far, when done
+      struct iovec iov;
+      int error;
+      slot() : state(idle), buf(NULL), offset(0), len(0), error(0) {}
+   };
+
+   int fd;
+   bool direct;
+   boost::uint64_t total_size;
+   boost::uint64_t pos;           // handed out, as the parser sees it
+   boost::uint64_t next_offset;   // of the next block for the parser
+   boost::uint64_t next_read;     // of the next block to start reading
+   size_t skip;                   // bytes of the next block before a seek() offset
+   size_t block_size;
+   std::vector<slot> slots;
+   int handed_out;                // slot the parser has, or -1
+
+   // io_uring, see setup_ring()
+   int ring_fd;
+   void* sq_ring;
+   void* cq_ring;
+   struct io_uring_sqe* sqes;
+   size_t sq_ring_size;
+   size_t cq_ring_size;
+   size_t sqes_size;
+   unsigned* sq_head;
+   unsigned* sq_tail;
+   unsigned* sq_mask;
+   unsigned* sq_array;
+   unsigned* cq_head;
+   unsigned* cq_tail;
+   unsigned* cq_mask;
+   struct io_uring_cqe* cqes;
+   size_t in_flight;
+
+   size_t find_slot( boost::uint64_t offset ) const
+   {
+      for (size_t i = 0; i != slots.size(); ++i)
+         if (slots[i].state != slot::idle && slots[i].offset == offset)
+            return i;
+      throw std::runtime_error("Error reading from input file (lost a block)");
+   }
+
+   // starts reading into every idle slot, in file order
+   void fill_queue()
+   {
+      for (size_t i = 0; i != slots.size() && next_read < total_size; ++i)
+      {
+         slot & s = slots[i];
+         if (s.state != slot::idle)
+            continue;
+         s.offset = next_read;
+         s.len = 0;
+         s.error = 0;
+         next_read += block_size;
+         start_read(s);
+      }
+      submit(0);
+   }
+
+   void start_read( slot & s )
+   {
+      s.state = slot::reading;
+      if (ring_fd < 0)
+      {
+         // read it when it is needed
+         return;
+      }
+      s.iov.iov_base = s.buf + s.len;
+      s.iov.iov_len = block_size - s.len;
+
+      const unsigned tail = *sq_tail;
+      const unsigned idx = tail & *sq_mask;
+      struct io_uring_sqe & sqe = sqes[idx];
+      memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_READV;
+      sqe.fd = fd;
+      sqe.addr = reinterpret_cast<boost::uint64_t>(&s.iov);
+      sqe.len = 1;
+      sqe.off = s.offset + s.len;
+      sqe.user_data = static_cast<boost::uint64_t>(&s - &slots[0]);
+      sq_array[idx] = idx;
+      __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+      ++in_flight;
+   }
+
+   // hands the queued reads to the kernel, and waits for at least min_complete
+   void submit( unsigned min_complete )
+   {
+      if (ring_fd < 0)
+         return;
+      const unsigned to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      if (to_submit == 0 && min_complete == 0)
+         return;
+      while (syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0)
+      {
+         if (errno != EINTR)
+            throw std::runtime_error("Error reading from input file (io_uring_enter)");
+      }
+   }
+
+   // takes every finished read off the completion queue
+   void reap()
+   {
+      unsigned head = *cq_head;
+      while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+      {
+         struct io_uring_cqe const& cqe = cqes[head & *cq_mask];
+         slot & s = slots[static_cast<size_t>(cqe.user_data)];
+         if (cqe.res < 0)
+            s.error = -cqe.res;
+         else
+            s.len += cqe.res;
+         s.state = slot::done;
+         --in_flight;
+         ++head;
+      }
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+   }
+
+   void wait_for( slot & s )
+   {
+      while (true)
+      {
+         while (s.state == slot::reading)
+         {
+            if (ring_fd < 0)
+               read_now(s);
+            else
+            {
+               reap();
+               if (s.state == slot::reading)
+                  submit(1);
+            }
+         }
+
+         if (s.error == EINVAL && direct)
+         {
+            stop_direct();
+            continue;
+         }
+         if (s.error)
+            throw std::runtime_error("Error reading from input file: " + std::string(strerror(s.error)));
+
+         // a short read before the end of the file, read the rest
+         const boost::uint64_t want = std::min<boost::uint64_t>(block_size, total_size - s.offset);
+         if (s.len >= want)
+            return;
+         if (s.len == 0 || s.len % alignment != 0)
+            throw std::runtime_error("Error reading from input file (file changed?)");
+         start_read(s);
+         submit(0);
+      }
+   }
+
+   void read_now( slot & s )
+   {
+      const ssize_t n = pread(fd, s.buf + s.len, block_size - s.len, s.offset + s.len);
+      if (n < 0)
+      {
+         if (errno == EINTR)
+            return;
+         s.error = errno;
+      }
+      else
+         s.len += n;
+      s.state = slot::done;
+   }
+
+   // The filesystem took O_DIRECT at open, but not for reading.
+   // Turns it off on the same fd (not a second open by name), and reads again the blocks that failed.
+   void stop_direct()
+   {
+      drain();
+      const int flags = fcntl(fd, F_GETFL);
+      if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) == -1)
+         throw std::runtime_error("Error reading from input file: " + std::string(strerror(EINVAL)));
+      direct = false;
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      for (size_t i = 0; i != slots.size(); ++i)
+      {
+         slot & s = slots[i];
+         if (s.state == slot::done && s.error != 0)
+         {
+            s.error = 0;
+            start_read(s);
+         }
+      }
+      submit(0);
+   }
+
+   // waits for the reads still in flight, the kernel is writing into the buffers
+   void drain()
+   {
+      while (in_flight != 0)
+      {
+         reap();
+         if (in_flight != 0)
+            submit(1);
+      }
+   }
+
+   void setup_ring()
+   {
+      struct io_uring_params p;
+      memset(&p, 0, sizeof(p));
+      const long rfd = syscall(__NR_io_uring_setup, static_cast<unsigned>(slots.size()), &p);
+      if (rfd < 0)
+         return;   // ENOSYS, EPERM, ... use pread()
+      ring_fd = static_cast<int>(rfd);
+
+      sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+      const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (single)
+         sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+      sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+      sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+      cq_ring = single ? sq_ring :
+         mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+      void* sq_entries = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+      if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sq_entries == MAP_FAILED)
+      {
+         if (sq_entries != MAP_FAILED)
+            munmap(sq_entries, sqes_size);
+         unmap_rings();
+         return;
+      }
+      sqes = static_cast<struct io_uring_sqe*>(sq_entries);
+
+      char* sq = static_cast<char*>(sq_ring);
+      sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+      sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+      sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+      sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+      char* cq = static_cast<char*>(cq_ring);
+      cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+      cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+      cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+      cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+   }
+
+   void unmap_rings()
+   {
+      if (cq_ring && cq_ring != MAP_FAILED && cq_ring != sq_ring)
+         munmap(cq_ring, cq_ring_size);
+      if (sq_ring && sq_ring != MAP_FAILED)
+         munmap(sq_ring, sq_ring_size);
+      sq_ring = cq_ring = NULL;
+      close(ring_fd);
+      ring_fd = -1;
+   }
+
+   void free_all()
+   {
+      if (ring_fd >= 0)
+      {
+         try {
+            drain();
+         }
+         catch (std::exception const&) {
+            // can't do much about it here
+         }
+         munmap(sqes, sqes_size);
+         unmap_rings();
+      }
+      for (size_t i = 0; i != slots.size(); ++i)
+         free(slots[i].buf);
+      if (fd >= 0)
+         close(fd);
+   }
+};
+
+
+} // namespace cppcsv
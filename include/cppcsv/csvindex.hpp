@@ -0,0 +1,250 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// A row index for big files: the byte offset of a row boundary every N rows,
+// built in one pass with csv_row_counter, and kept in a small sidecar file.
+//
+//    cppcsv::csv_dialect<char,char,char> dialect('"', ',');
+//    cppcsv::csv_index index;
+//    {
+//       cppcsv::file_source in("big.csv");
+//       if (index.build(in, dialect, 100000))
+//          handle error;
+//       index.save("big.csv.idx");
+//    }
+//
+//    // later, parse from row 123456789 (counting from 0)
+//    index.load("big.csv.idx");
+//    cppcsv::file_source in("big.csv");
+//    cppcsv::csv_parser<MyBuilder> parser(builder, dialect);
+//    if (cppcsv::seek_row(index, in, dialect, 123456789, parser))
+//       handle error;
+//    cppcsv::parse_source(parser, in);
+//
+// Every entry is between rows (the parser's Start state, not in a comment),
+// so the only state needed to carry on from it is the file line it is on,
+// for csv_parser::resume_at_row() to keep the row numbers right.
+//
+// parallel_csv_parser::parse() can also take an index, to cut the input at
+// known row boundaries instead of guessing (see csvparallel.hpp).
+//
+// The index must have been built with the same dialect, from the same data.
+
+#include "csvcount.hpp"
+#include "csvsource.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+namespace cppcsv {
+
+
+class csv_index {
+public:
+   struct entry {
+      boost::uint64_t offset;    // byte offset of a row boundary
+      boost::uint64_t row;       // rows before it
+      boost::uint64_t line;      // file line it is on
+   };
+
+   csv_index() : row_interval(0), input_size(0), total_rows(0) {}
+
+   // builds the index in one pass, with an entry at the start and then after every interval rows
+   // NOTE: returns true on error
+   template <class QuoteChars, class Separators, class CommentChars>
+   bool build( input_source & source, csv_dialect<QuoteChars,Separators,CommentChars> const& dialect, size_t interval )
+   {
+      csv_row_counter<QuoteChars,Separators,CommentChars> counter(dialect);
+      counter.set_mark_interval(interval);
+      const bool failed = parse_source(counter, source);
+
+      row_interval = interval;
+      input_size = source.position();
+      total_rows = counter.rows();
+
+      entry first = { 0, 0, 1 };
+      entries.assign(1, first);
+      typedef typename csv_row_counter<QuoteChars,Separators,CommentChars>::row_mark row_mark;
+      std::vector<row_mark> const& marks = counter.marks();
+      for (size_t i = 0; i != marks.size(); ++i)
+      {
+         entry e = { marks[i].offset, marks[i].rows, marks[i].line };
+         entries.push_back(e);
+      }
+      return failed;
+   }
+
+   // the last entry at or before row (counting from 0)
+   entry const& find( boost::uint64_t row ) const
+   {
+      assert(!entries.empty());
+      size_t lo = 0, hi = entries.size();
+      while (hi - lo > 1)
+      {
+         const size_t mid = lo + (hi - lo) / 2;
+         if (entries[mid].row <= row)
+            lo = mid;
+         else
+            hi = mid;
+      }
+      return entries[lo];
+   }
+
+   // the first entry offset at or after offset, or size() if there is none
+   boost::uint64_t boundary_at_or_after( boost::uint64_t offset ) const
+   {
+      size_t lo = 0, hi = entries.size();
+      while (lo != hi)
+      {
+         const size_t mid = lo + (hi - lo) / 2;
+         if (entries[mid].offset < offset)
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+      return lo == entries.size() ? input_size : entries[lo].offset;
+   }
+
+   std::vector<entry> const& get_entries() const { return entries; }
+   size_t interval() const { return row_interval; }
+   boost::uint64_t size() const { return input_size; }      // of the indexed input
+   boost::uint64_t rows() const { return total_rows; }
+
+
+   // the sidecar file: a header, then the entries, all as little-endian 64 bit numbers.
+   // I/O errors are thrown as std::runtime_error.
+   void save( const char* filename ) const
+   {
+      FILE* f = fopen(filename, "wb");
+      if (!f)
+         throw std::runtime_error("Could not open index file for writing " + std::string(filename));
+
+      std::vector<unsigned char> out(magic(), magic() + magic_size);
+      put(out, static_cast<boost::uint64_t>(version));
+      put(out, row_interval);
+      put(out, input_size);
+      put(out, total_rows);
+      put(out, entries.size());
+      for (size_t i = 0; i != entries.size(); ++i)
+      {
+         put(out, entries[i].offset);
+         put(out, entries[i].row);
+         put(out, entries[i].line);
+      }
+
+      const bool ok = fwrite(&out[0], 1, out.size(), f) == out.size();
+      if (fclose(f) != 0 || !ok)
+         throw std::runtime_error("Error writing index file " + std::string(filename));
+   }
+
+   void load( const char* filename )
+   {
+      FILE* f = fopen(filename, "rb");
+      if (!f)
+         throw std::runtime_error("Could not open index file " + std::string(filename));
+
+      std::vector<unsigned char> in;
+      unsigned char buf[4096];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), f)) != 0)
+         in.insert(in.end(), buf, buf + n);
+      const bool read_error = ferror(f) != 0;
+      fclose(f);
+
+      const size_t header_size = magic_size + 5*8;
+      if (read_error || in.size() < header_size || !std::equal(magic(), magic() + magic_size, in.begin()))
+         throw std::runtime_error("Not a csv index file " + std::string(filename));
+
+      size_t pos = magic_size;
+      if (get(in, pos) != static_cast<boost::uint64_t>(version))
+         throw std::runtime_error("Unknown csv index file version " + std::string(filename));
+      row_interval = static_cast<size_t>(get(in, pos));
+      input_size = get(in, pos);
+      total_rows = get(in, pos);
+      const boost::uint64_t num_entries = get(in, pos);
+      if (num_entries == 0 || (in.size() - header_size) / (3*8) != num_entries)
+         throw std::runtime_error("Corrupt csv index file " + std::string(filename));
+
+      entries.resize(static_cast<size_t>(num_entries));
+      for (size_t i = 0; i != entries.size(); ++i)
+      {
+         entries[i].offset = get(in, pos);
+         entries[i].row = get(in, pos);
+         entries[i].line = get(in, pos);
+      }
+   }
+
+private:
+   enum { magic_size = 8, version = 1 };
+   static const char* magic() { return "cppcsvix"; }
+
+   size_t row_interval;
+   boost::uint64_t input_size;
+   boost::uint64_t total_rows;
+   std::vector<entry> entries;
+
+   static void put( std::vector<unsigned char> & out, boost::uint64_t v )
+   {
+      for (int i = 0; i != 8; ++i)
+         out.push_back(static_cast<unsigned char>(v >> (8*i)));
+   }
+
+   static boost::uint64_t get( std::vector<unsigned char> const& in, size_t & pos )
+   {
+      boost::uint64_t v = 0;
+      for (int i = 0; i != 8; ++i)
+         v |= static_cast<boost::uint64_t>(in[pos+i]) << (8*i);
+      pos += 8;
+      return v;
+   }
+};
+
+
+// Finds row (counting from 0) in source, using the index to start near it,
+// and leaves source and parser ready for parse_source() to carry on from that row.
+// parser must be new (or between rows).
+// NOTE: returns true on error (a parse error, row past the end, or source can't seek)
+template <class QuoteChars, class Separators, class CommentChars, class Parser>
+bool seek_row( csv_index const& index, input_source & source,
+      csv_dialect<QuoteChars,Separators,CommentChars> const& dialect, boost::uint64_t row, Parser & parser )
+{
+   csv_index::entry const& e = index.find(row);
+   if (!source.seek(e.offset))
+      return true;
+
+   boost::uint64_t offset = e.offset;
+   boost::uint64_t line = e.line;
+   if (row != e.row)
+   {
+      // count the rest of the way
+      csv_row_counter<QuoteChars,Separators,CommentChars> counter(dialect);
+      counter.resume_at(e.offset, static_cast<size_t>(e.line));
+      counter.set_mark_interval(static_cast<size_t>(row - e.row));
+
+      const char* data;
+      while (counter.marks().empty())
+      {
+         const size_t n = source.next(data);
+         if (n == 0 || counter.process_chunk(data, n))
+            return true;
+      }
+      offset = counter.marks()[0].offset;
+      line = counter.marks()[0].line;
+      if (!source.seek(offset))
+         return true;
+   }
+
+   if (line > 1)
+      parser.resume_at_row(static_cast<size_t>(line));
+   return false;
+}
+
+
+} // namespace cppcsv
@@ -0,0 +1,472 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Parses one big buffer (eg a memory mapped file) on several threads,
+// and gives exactly the same rows, in the same order and with the same
+// file_row numbers, as a csv_parser would, to a per_row_tag builder.
+//
+// How it works:
+// The buffer is cut into ranges just after newlines, and each range is parsed
+// by its own thread into a row store.  A thread cannot know if its range starts
+// between rows, or inside a quoted cell that has newlines in it, so it guesses:
+//  - "between rows", so the range is parsed from its start, and
+//  - "inside a cell quoted with q", for each quote char q.  This is only parsed
+//    up to the first point where it is between rows again, which is
+//    usually only a line or two (or an error, which rules it out).
+// Once the parser is between rows the past no longer matters,
+// so each guess gives an "entry point": an offset in the buffer, and the rows
+// the range's parse produces from there.  Each thread also parses past the end
+// of its range, to finish the row that crosses the end.
+//
+// The main thread then walks the ranges in order: the previous range ended
+// between rows at offset cur, so it takes the rows from this range's entry
+// point at cur.  If there is none (or that parse hit an error, or gave up on
+// a very long row) it parses from cur itself, so errors are reported just as
+// csv_parser reports them.
+//
+// Ranges are handled a window (one range per thread) at a time,
+// so only one window's rows are kept in memory.
+//
+// Given a csv_index of the buffer (see csvindex.hpp), the ranges are cut at
+// row boundaries from the index instead, so no guessing is needed.
+
+#include "csvindex.hpp"
+#include "csvparser.hpp"
+
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cppcsv {
+
+namespace parallel_detail {
+
+   // keeps every row it is given, to be passed on later
+   class row_store : public per_row_tag {
+   public:
+      struct row {
+         size_t chars_begin;
+         size_t offsets_begin;
+         size_t num_cells;
+         size_t file_row;
+      };
+
+      std::vector<char> chars;
+      std::vector<size_t> offsets;
+      std::vector<row> rows;
+
+      void end_full_row( char* buffer, size_t num_cells, const size_t * offs, size_t file_row )
+      {
+         // offs[0] is always zero, so the offsets stay the same
+         row r = { chars.size(), offsets.size(), num_cells, file_row };
+         chars.insert(chars.end(), buffer, buffer + offs[num_cells]);
+         offsets.insert(offsets.end(), offs, offs + num_cells + 1);
+         rows.push_back(r);
+      }
+   };
+
+   // for the guesses that only look for an entry point
+   class null_row_builder : public per_row_tag {
+   public:
+      void end_full_row( char*, size_t, const size_t *, size_t ) {}
+   };
+
+   // one parse of (part of) a range
+   struct run_result {
+      row_store store;
+      size_t end;             // the last offset where the parse was between rows
+      size_t end_num_rows;    // rows stored by then
+      size_t end_row;         // parser's current row there
+   };
+
+   // where the rows of a run can be used from
+   struct entry_point {
+      size_t offset;
+      size_t run;
+      size_t first_row;       // index into the run's rows
+      size_t row;             // parser's current row at offset
+   };
+
+   struct range_job {
+      size_t begin, end;      // the range, both just after a newline (or 0 / the buffer end)
+      size_t limit;           // how far to go past end to finish the crossing row
+      bool known_begin;       // begin is known to be between rows (from an index)
+      std::deque<run_result> runs;
+      std::vector<entry_point> entries;
+   };
+
+} // namespace parallel_detail
+
+
+
+template <class CsvBuilder, class QuoteChars = char, class Separators = char, class CommentChars = char>
+class parallel_csv_parser
+{
+   // disable copy
+   parallel_csv_parser& operator=(parallel_csv_parser const&);
+   parallel_csv_parser(parallel_csv_parser const&);
+
+public:
+   typedef csv_dialect<QuoteChars,Separators,CommentChars> Dialect;
+
+   // num_threads = 0 means one per core
+   parallel_csv_parser( CsvBuilder & out, Dialect const& dialect, unsigned num_threads = 0 ) :
+      out(out),
+      dialect(dialect),
+      quiet_dialect(dialect),
+      num_threads(num_threads ? num_threads : boost::thread::hardware_concurrency()),
+      chunk_size(8*1024*1024),
+      errmsg(NULL),
+      current_row(1),
+      current_column(0)
+   {
+      if (this->num_threads == 0)
+         this->num_threads = 1;
+
+      // the threads never report their errors, see parse_sequential()
+      quiet_dialect.collect_error_context = false;
+
+      // find the quote chars by asking a parser
+      parallel_detail::null_row_builder nb;
+      csv_parser<parallel_detail::null_row_builder,QuoteChars,Separators,CommentChars> p(nb, dialect);
+      for (int c = 0; c != 256; ++c)
+         if (p.is_quote_char(static_cast<char>(c)))
+            quote_chars.push_back(static_cast<char>(c));
+   }
+
+   // bytes per range, default is 8 MB
+   void set_chunk_size( size_t bytes )
+   {
+      chunk_size = bytes ? bytes : 1;
+   }
+
+   // parses everything, as if by csv_parser::process_chunk(data,len) then flush()
+   // NOTE: returns true on error
+   bool parse( const char* data, size_t len )
+   {
+      return parse(data, len, NULL);
+   }
+
+   // same, with ranges cut at the row boundaries in index (which must be for this data,
+   // and the same dialect), it is ignored if it was built from input of a different size
+   bool parse( const char* data, size_t len, csv_index const& index )
+   {
+      return parse(data, len, index.size() == len ? &index : NULL);
+   }
+
+   // note: returns NULL if no error
+   const char * error() const { return errmsg; }
+   std::string error_context() const { return err_context; }
+
+   size_t get_current_row() const { return current_row; }
+   size_t get_current_column() const { return current_column; }
+
+private:
+   bool parse( const char* data, size_t len, csv_index const* index )
+   {
+      errmsg = NULL;
+      err_context.clear();
+
+      size_t cur = 0;         // everything before cur has been sent to out
+      size_t cur_row = 1;     // the row number at cur
+
+      size_t pos = 0;
+      std::vector<parallel_detail::range_job> jobs;
+      while (pos < len)
+      {
+         // cut the next window into ranges
+         jobs.clear();
+         jobs.resize(num_threads);
+         size_t num_jobs = 0;
+         for ( ; num_jobs != num_threads && pos < len; ++num_jobs)
+         {
+            parallel_detail::range_job & job = jobs[num_jobs];
+            job.begin = pos;
+            if (index)
+               job.end = static_cast<size_t>(index->boundary_at_or_after(std::min(len, pos + chunk_size)));
+            else
+               job.end = line_end(data, len, std::min(len, pos + chunk_size));
+            job.limit = std::min(len, job.end + chunk_size);
+            job.known_begin = (index != NULL);
+            pos = job.end;
+         }
+
+         if (num_jobs == 1)
+            parse_range(data, len, jobs[0]);
+         else
+         {
+            boost::thread_group threads;
+            for (size_t i = 0; i != num_jobs; ++i)
+               threads.create_thread(boost::bind(&parallel_csv_parser::parse_range, this, data, len, boost::ref(jobs[i])));
+            threads.join_all();
+         }
+
+         // stitch, in order
+         for (size_t i = 0; i != num_jobs; ++i)
+         {
+            parallel_detail::range_job & job = jobs[i];
+            if (cur >= job.end)
+               continue;   // the previous row went right over this range
+
+            if (!take_rows(job, cur, cur_row, len) && !parse_sequential(data, len, cur, cur_row, job.end))
+               return true;
+         }
+      }
+
+      current_row = cur_row;
+      current_column = 0;
+      for (size_t i = len; i != 0 && data[i-1] != '\n'; --i)
+         ++current_column;
+      return false;
+   }
+
+   typedef csv_parser<parallel_detail::row_store,QuoteChars,Separators,CommentChars> StoreParser;
+   typedef csv_parser<parallel_detail::null_row_builder,QuoteChars,Separators,CommentChars> NullParser;
+
+   // hands rows straight to out
+   class forward_builder : public per_row_tag {
+   public:
+      CsvBuilder & out;
+      forward_builder( CsvBuilder & out ) : out(out) {}
+
+      void end_full_row( char* buffer, size_t num_cells, const size_t * offsets, size_t file_row )
+      {
+         out.end_full_row(buffer, num_cells, offsets, file_row);
+      }
+   };
+   typedef csv_parser<forward_builder,QuoteChars,Separators,CommentChars> ForwardParser;
+
+   CsvBuilder & out;
+   Dialect dialect;
+   Dialect quiet_dialect;
+   std::vector<char> quote_chars;
+   size_t num_threads;
+   size_t chunk_size;
+
+   const char* errmsg;
+   std::string err_context;
+   size_t current_row, current_column;
+
+
+   // one past the next newline at or after pos, or len
+   static size_t line_end( const char* data, size_t len, size_t pos )
+   {
+      const void* nl = memchr(data + pos, '\n', len - pos);
+      return nl ? static_cast<const char*>(nl) - data + 1 : len;
+   }
+
+   // parses [from,to), and notes it if the parser ends between rows
+   // returns false on error
+   template <class Parser>
+   static bool feed( Parser & p, parallel_detail::run_result & r, const char* data, size_t from, size_t to )
+   {
+      const char* cursor = data + from;
+      if (to > from && p.process_chunk(cursor, to - from))
+         return false;
+      if (p.at_row_boundary())
+      {
+         r.end = to;
+         r.end_num_rows = r.store.rows.size();
+         r.end_row = p.get_current_row();
+      }
+      return true;
+   }
+
+   // carries on a line at a time, until between rows, or limit is reached
+   template <class Parser>
+   static void finish_row( Parser & p, parallel_detail::run_result & r, const char* data, size_t len, size_t pos, size_t limit )
+   {
+      while (r.end != pos && pos < limit)
+      {
+         const size_t next = line_end(data, len, pos);
+         if (!feed(p, r, data, pos, next))
+            return;
+         pos = next;
+      }
+      if (r.end != pos && pos == len && !p.flush())
+      {
+         r.end = len;
+         r.end_num_rows = r.store.rows.size();
+         r.end_row = p.get_current_row();
+      }
+   }
+
+   // starts a run at offset (between rows), and parses until the row crossing job.end is done
+   void start_run( const char* data, size_t len, parallel_detail::range_job & job, size_t offset, size_t row ) const
+   {
+      job.runs.push_back(parallel_detail::run_result());
+      parallel_detail::run_result & r = job.runs.back();
+      r.end = offset;
+      r.end_num_rows = 0;
+      r.end_row = row;
+
+      parallel_detail::entry_point e = { offset, job.runs.size()-1, 0, row };
+      job.entries.push_back(e);
+
+      StoreParser p(r.store, quiet_dialect);
+      if (offset > 0)
+         p.resume_at_row(row);
+      if (feed(p, r, data, offset, job.end))
+         finish_row(p, r, data, len, job.end, job.limit);
+   }
+
+   // runs on a worker thread
+   void parse_range( const char* data, size_t len, parallel_detail::range_job & job ) const
+   {
+      // row numbers are relative to the range, the stitching adjusts them.
+      // Not 1, as resume_at_row() has to pretend there was a row before.
+      const size_t first_row = (job.begin == 0 ? 1 : 2);
+
+      // guess: inside a quoted cell, find where that would end the row
+      std::vector< std::pair<size_t,size_t> > candidates;   // (offset, row)
+      for (size_t i = 0; job.begin > 0 && !job.known_begin && i != quote_chars.size(); ++i)
+      {
+         const char q = quote_chars[i];
+         if (!memchr(data + job.begin, q, job.end - job.begin))
+            continue;   // the quote could not close in this range
+
+         parallel_detail::null_row_builder nb;
+         NullParser p(nb, quiet_dialect);
+         p.resume_inside_quotes(first_row, q);
+
+         size_t pos = job.begin;
+         while (pos < job.end)
+         {
+            const size_t next = line_end(data, len, pos);
+            const char* cursor = data + pos;
+            if (p.process_chunk(cursor, next - pos))
+               break;
+            pos = next;
+            if (p.at_row_boundary())
+            {
+               if (pos < job.end)
+                  candidates.push_back(std::make_pair(pos, p.get_current_row()));
+               break;
+            }
+         }
+      }
+      std::sort(candidates.begin(), candidates.end());
+      candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+      // guess: between rows, parse the whole range, noting if it agrees with the candidates
+      job.runs.push_back(parallel_detail::run_result());
+      parallel_detail::run_result & r = job.runs.back();
+      r.end = job.begin;
+      r.end_num_rows = 0;
+      r.end_row = first_row;
+      parallel_detail::entry_point e = { job.begin, 0, 0, first_row };
+      job.entries.push_back(e);
+
+      std::vector< std::pair<size_t,size_t> > disagree;
+      {
+         StoreParser p(r.store, quiet_dialect);
+         if (job.begin > 0)
+            p.resume_at_row(first_row);
+
+         size_t pos = job.begin;
+         bool ok = true;
+         for (size_t i = 0; i != candidates.size(); ++i)
+         {
+            if (ok && feed(p, r, data, pos, candidates[i].first))
+            {
+               pos = candidates[i].first;
+               if (r.end == pos)
+               {
+                  parallel_detail::entry_point c = { pos, 0, r.end_num_rows, r.end_row };
+                  job.entries.push_back(c);
+                  continue;
+               }
+            }
+            else
+               ok = false;
+            disagree.push_back(candidates[i]);
+         }
+
+         if (ok && feed(p, r, data, pos, job.end))
+            finish_row(p, r, data, len, job.end, job.limit);
+      }
+
+      // the guesses disagree, parse again from the other entry points
+      for (size_t i = 0; i != disagree.size(); ++i)
+         start_run(data, len, job, disagree[i].first, disagree[i].second);
+   }
+
+   // sends the rows of the entry point at cur, if there is one,
+   // returns false if the caller must parse from cur itself
+   bool take_rows( parallel_detail::range_job & job, size_t & cur, size_t & cur_row, size_t len )
+   {
+      for (size_t i = 0; i != job.entries.size(); ++i)
+      {
+         parallel_detail::entry_point const& e = job.entries[i];
+         if (e.offset != cur)
+            continue;
+
+         parallel_detail::run_result & r = job.runs[e.run];
+         parallel_detail::row_store & store = r.store;
+         char * chars = store.chars.empty() ? NULL : &store.chars[0];
+         for (size_t k = e.first_row; k < r.end_num_rows; ++k)
+         {
+            parallel_detail::row_store::row const& row = store.rows[k];
+            out.end_full_row(
+                  chars + row.chars_begin,
+                  row.num_cells,
+                  &store.offsets[row.offsets_begin],
+                  row.file_row + cur_row - e.row);
+         }
+
+         cur_row = r.end_row + cur_row - e.row;
+         cur = r.end;
+         return cur >= job.end || cur == len;
+      }
+      return false;
+   }
+
+   // plain csv_parser from cur (between rows) up to the first row end at or after stop,
+   // returns false on error
+   bool parse_sequential( const char* data, size_t len, size_t & cur, size_t & cur_row, size_t stop )
+   {
+      forward_builder fb(out);
+      ForwardParser p(fb, dialect);
+      if (cur > 0)
+         p.resume_at_row(cur_row);
+
+      bool failed = false;
+      size_t pos = cur;
+      while (pos < len && !(pos >= stop && p.at_row_boundary()))
+      {
+         const size_t next = line_end(data, len, pos);
+         const char* cursor = data + pos;
+         if (p.process_chunk(cursor, next - pos))
+         {
+            failed = true;
+            break;
+         }
+         pos = next;
+      }
+      if (!failed && pos == len)
+         failed = p.flush();
+
+      if (failed)
+      {
+         errmsg = p.error();
+         err_context = p.error_context();
+         current_row = p.get_current_row();
+         current_column = p.get_current_column();
+         return false;
+      }
+
+      cur = pos;
+      cur_row = p.get_current_row();
+      return true;
+   }
+};
+
+
+} // namespace cppcsv
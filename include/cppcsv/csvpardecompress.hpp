@@ -0,0 +1,858 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Decompresses block compressed input on several threads, and hands the
+// blocks out in order, so a fast parser is not held up by one inflate thread:
+//
+//    cppcsv::file_source file("big.csv.gz");       // memory mapped
+//    if (!file.is_mapped())
+//       use a decompress_source instead;
+//    cppcsv::parallel_decompress_source in(file.mapped_data(), file.size());
+//    if (cppcsv::parse_source(parser, in))
+//       handle error;
+//
+// The input must be in memory (eg a mapped file), so the threads can each take their own part.
+// How it is cut into blocks depends on what it is:
+//  - BGZF (bgzip, samtools etc): every gzip member says how long it is,
+//    and how big it is decompressed, so the block index is there from the start.
+//  - zstd, one frame after another (zstd's seekable format, zstd -B, cat a.zst b.zst):
+//    the frame and block headers give the frame lengths, and the decompressed sizes
+//    are in the frame headers or the seekable format's seek table, if anywhere
+//    (if not, the block index is known once the input has been read to the end).
+//    Needs CPPCSV_HAVE_ZSTD, see csvdecompress.hpp.
+//  - other concatenated gzip members (cat a.gz b.gz, split then gzip'ed):
+//    member lengths are not written down, so every place that looks like a gzip header
+//    is decompressed from, and the results are kept only for the places
+//    where a member really starts (where the one before it ended).
+//    The block index is known once the input has been read to the end.
+// A single gzip member, a single zstd frame, or a block that comes out bigger than
+// max_job_output can only be decompressed from its start, on one thread (a
+// prefetch_source), and uncompressed input is handed out as it is.
+//
+// With the block index, seek() works on decompressed offsets, so a csv_index
+// (see csvindex.hpp) built on this source can seek_row() straight into the
+// compressed file: only the block the row is in, and the ones after it, are decompressed.
+//
+// Corrupt or truncated input is thrown as std::runtime_error, from next(),
+// once everything before it has been handed out.
+
+#include "csvdecompress.hpp"
+#include "csvsource.hpp"
+
+#include <boost/bind/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+namespace cppcsv {
+
+
+struct compressed_block {
+   boost::uint64_t offset;          // in the compressed input
+   boost::uint64_t size;            // compressed bytes
+   boost::uint64_t data_offset;     // in the decompressed data, only with the whole block index
+   boost::uint64_t data_size;       // decompressed bytes, unknown_size if not known
+};
+
+
+namespace pardecompress_detail {
+
+   static const boost::uint64_t unknown_size = ~static_cast<boost::uint64_t>(0);
+
+   inline boost::uint32_t le16( const unsigned char* p ) { return p[0] | (p[1] << 8); }
+   inline boost::uint32_t le32( const unsigned char* p )
+   {
+      return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<boost::uint32_t>(p[3]) << 24);
+   }
+   inline boost::uint64_t le64( const unsigned char* p )
+   {
+      return le32(p) | (static_cast<boost::uint64_t>(le32(p + 4)) << 32);
+   }
+
+   inline void add_block( std::vector<compressed_block> & blocks, size_t offset, size_t size, boost::uint64_t data_size )
+   {
+      compressed_block b = { offset, size, 0, data_size };
+      blocks.push_back(b);
+   }
+
+   // BGZF: the BC extra field of every member has its length.
+   // false unless the members go exactly to the end
+   inline bool find_bgzf_blocks( const unsigned char* p, size_t len, std::vector<compressed_block> & blocks )
+   {
+      size_t off = 0;
+      while (off != len)
+      {
+         const unsigned char* h = p + off;
+         if (len - off < 18 || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || !(h[3] & 4))
+            return false;
+         const size_t xlen = le16(h + 10);
+         if (len - off < 12 + xlen)
+            return false;
+
+         size_t bsize = 0;
+         for (size_t x = 0; x + 4 <= xlen; x += 4 + le16(h + 12 + x + 2))
+         {
+            const unsigned char* s = h + 12 + x;
+            if (s[0] == 'B' && s[1] == 'C' && le16(s + 2) == 2 && x + 6 <= xlen)
+               bsize = le16(s + 4) + 1;
+         }
+         if (bsize < 12 + xlen + 8 || bsize > len - off)
+            return false;
+
+         add_block(blocks, off, bsize, le32(h + bsize - 4));   // ISIZE
+         off += bsize;
+      }
+      return true;
+   }
+
+   // zstd: frame headers, then block headers up to the last block.
+   // Skippable frames are stepped over (a seek table is read on the way).
+   // false unless the frames go exactly to the end
+   inline bool find_zstd_frames( const unsigned char* p, size_t len, std::vector<compressed_block> & blocks )
+   {
+      const unsigned char* table = NULL;
+      size_t table_len = 0;
+      size_t off = 0;
+      while (off != len)
+      {
+         const unsigned char* h = p + off;
+         if (len - off < 8)
+            return false;
+         const boost::uint32_t magic = le32(h);
+         if ((magic & 0xfffffff0) == 0x184d2a50)
+         {
+            const size_t skip = le32(h + 4);
+            if (skip > len - off - 8)
+               return false;
+            if (magic == 0x184d2a5e && skip >= 9 && le32(h + 8 + skip - 4) == 0x8f92eab1)
+            {
+               // the seekable format's seek table
+               table = h + 8;
+               table_len = skip;
+            }
+            off += 8 + skip;
+            continue;
+         }
+         if (magic != 0xfd2fb528)
+            return false;
+
+         const unsigned fhd = h[4];
+         if (fhd & 8)
+            return false;   // reserved bit
+         static const size_t did_sizes[4] = { 0, 1, 2, 4 };
+         const bool single_segment = (fhd >> 5) & 1;
+         const size_t fcs_size = (fhd >> 6) == 0 ? (single_segment ? 1 : 0) : (size_t(1) << (fhd >> 6));
+         size_t pos = 5 + (single_segment ? 0 : 1) + did_sizes[fhd & 3];
+         if (len - off < pos + fcs_size)
+            return false;
+
+         boost::uint64_t content = unknown_size;
+         if (fcs_size == 1)
+            content = h[pos];
+         else if (fcs_size == 2)
+            content = le16(h + pos) + 256;
+         else if (fcs_size == 4)
+            content = le32(h + pos);
+         else if (fcs_size == 8)
+            content = le64(h + pos);
+         pos += fcs_size;
+
+         while (true)
+         {
+            if (len - off < pos + 3)
+               return false;
+            const boost::uint32_t bh = h[pos] | (h[pos+1] << 8) | (h[pos+2] << 16);
+            const unsigned type = (bh >> 1) & 3;
+            if (type == 3)
+               return false;
+            const size_t body = (type == 1) ? 1 : (bh >> 3);   // RLE blocks are one byte
+            pos += 3;
+            if (len - off - pos < body)
+               return false;
+            pos += body;
+            if (bh & 1)
+               break;   // last block
+         }
+         if (fhd & 4)
+         {
+            if (len - off - pos < 4)
+               return false;
+            pos += 4;   // checksum
+         }
+
+         add_block(blocks, off, pos, content);
+         off += pos;
+      }
+
+      if (table)
+      {
+         // entries of compressed size, decompressed size (and a checksum), then a 9 byte footer
+         const size_t num = le32(table + table_len - 9);
+         const size_t entry = (table[table_len - 5] & 0x80) ? 12 : 8;
+         if (num == blocks.size() && num*entry + 9 == table_len)
+            for (size_t i = 0; i != num; ++i)
+               if (blocks[i].size == le32(table + i*entry))
+                  blocks[i].data_size = le32(table + i*entry + 4);
+      }
+      return true;
+   }
+
+   // everything that looks like the start of a gzip member, sized up to the next one
+   inline void find_gzip_members( const unsigned char* p, size_t len, std::vector<compressed_block> & blocks )
+   {
+      const unsigned char* const end = p + len;
+      for (const unsigned char* c = p; end - c >= 18; ++c)
+      {
+         c = static_cast<const unsigned char*>(memchr(c, 0x1f, end - c - 17));
+         if (!c)
+            break;
+         // deflate, no reserved flags, a known XFL and OS
+         if (c[1] == 0x8b && c[2] == 8 && (c[3] & 0xe0) == 0 &&
+               (c[8] == 0 || c[8] == 2 || c[8] == 4) && (c[9] <= 13 || c[9] == 255))
+            add_block(blocks, c - p, 0, unknown_size);
+      }
+      for (size_t i = 0; i != blocks.size(); ++i)
+         blocks[i].size = (i+1 == blocks.size() ? len : blocks[i+1].offset) - blocks[i].offset;
+   }
+
+
+   // thrown when a job comes out bigger than max_job_output
+   struct too_big {};
+
+   // one per worker thread
+   class block_decoder {
+      // noncopyable
+      block_decoder( block_decoder const& );
+      block_decoder& operator=( block_decoder const& );
+
+   public:
+      block_decoder() :
+         zs_ready(false)
+#ifdef CPPCSV_HAVE_ZSTD
+         , zstd(NULL)
+#endif
+      {
+      }
+
+      ~block_decoder()
+      {
+         if (zs_ready)
+            inflateEnd(&zs);
+#ifdef CPPCSV_HAVE_ZSTD
+         ZSTD_freeDStream(zstd);
+#endif
+      }
+
+      // appends the gzip member that starts at in to out, returns its compressed length
+      size_t gunzip( const char* in, size_t in_len, boost::uint64_t size_hint, std::vector<char> & out, size_t cap )
+      {
+         if (!zs_ready)
+         {
+            memset(&zs, 0, sizeof(zs));
+            if (inflateInit2(&zs, 15 + 16) != Z_OK)
+               throw std::runtime_error("Could not start gzip decompression");
+            zs_ready = true;
+         }
+         else if (inflateReset(&zs) != Z_OK)
+            throw std::runtime_error("Could not restart gzip decompression");
+
+         size_t used = out.size();
+         reserve(out, used, size_hint, cap);
+         size_t left = in_len;
+         while (true)
+         {
+            if (used == out.size())
+               grow(out, cap);
+            const uInt avail_in = static_cast<uInt>(std::min<size_t>(left, UINT_MAX));
+            const uInt avail_out = static_cast<uInt>(std::min<size_t>(out.size() - used, UINT_MAX));
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in + (in_len - left)));
+            zs.avail_in = avail_in;
+            zs.next_out = reinterpret_cast<Bytef*>(&out[used]);
+            zs.avail_out = avail_out;
+            const int ret = inflate(&zs, Z_NO_FLUSH);
+            left -= avail_in - zs.avail_in;
+            used += avail_out - zs.avail_out;
+
+            if (ret == Z_STREAM_END)
+               break;
+            if (ret == Z_BUF_ERROR && left == 0)
+               throw std::runtime_error("Truncated gzip input");
+            if (ret != Z_OK && ret != Z_BUF_ERROR)
+               throw std::runtime_error(std::string("Corrupt gzip input: ") + (zs.msg ? zs.msg : "inflate failed"));
+         }
+         out.resize(used);
+         return in_len - left;
+      }
+
+#ifdef CPPCSV_HAVE_ZSTD
+      // appends the zstd frame at in (exactly in_len long) to out
+      size_t unzstd( const char* in, size_t in_len, boost::uint64_t size_hint, std::vector<char> & out, size_t cap )
+      {
+         if (!zstd && (zstd = ZSTD_createDStream()) == NULL)
+            throw std::runtime_error("Could not start zstd decompression");
+         if (ZSTD_isError(ZSTD_initDStream(zstd)))
+            throw std::runtime_error("Could not start zstd decompression");
+
+         size_t used = out.size();
+         reserve(out, used, size_hint, cap);
+         ZSTD_inBuffer ib = { in, in_len, 0 };
+         while (true)
+         {
+            if (used == out.size())
+               grow(out, cap);
+            ZSTD_outBuffer ob = { &out[0], out.size(), used };
+            const size_t ret = ZSTD_decompressStream(zstd, &ob, &ib);
+            used = ob.pos;
+            if (ZSTD_isError(ret))
+               throw std::runtime_error(std::string("Corrupt zstd input: ") + ZSTD_getErrorName(ret));
+            if (ret == 0)
+               break;
+            if (ib.pos == ib.size && ob.pos != ob.size)
+               throw std::runtime_error("Truncated zstd input");
+         }
+         out.resize(used);
+         return ib.pos;
+      }
+#else
+      size_t unzstd( const char*, size_t, boost::uint64_t, std::vector<char> &, size_t )
+      {
+         throw std::runtime_error("Input is zstd compressed, build with CPPCSV_HAVE_ZSTD to read it");
+      }
+#endif
+
+   private:
+      z_stream zs;
+      bool zs_ready;
+#ifdef CPPCSV_HAVE_ZSTD
+      ZSTD_DStream* zstd;
+#endif
+
+      // room for what the block is expected to come to
+      static void reserve( std::vector<char> & out, size_t used, boost::uint64_t size_hint, size_t cap )
+      {
+         const boost::uint64_t want = std::min<boost::uint64_t>(size_hint, cap + 1);
+         if (want > out.size() - used)
+            out.resize(used + static_cast<size_t>(std::min<boost::uint64_t>(want, cap + 1 - std::min(used, cap))));
+      }
+
+      // out is full: twice the size, up to one past cap, to see it go over
+      static void grow( std::vector<char> & out, size_t cap )
+      {
+         if (out.size() > cap)
+            throw too_big();
+         out.resize(std::min<size_t>(std::max<size_t>(out.size()*2, 65536), cap + 1));
+      }
+   };
+
+} // namespace pardecompress_detail
+
+
+
+class parallel_decompress_source : public input_source {
+   // noncopyable
+   parallel_decompress_source( parallel_decompress_source const& );
+   parallel_decompress_source& operator=( parallel_decompress_source const& );
+
+public:
+   static const size_t default_job_bytes = 1024*1024;
+   static const size_t default_max_job_output = 64*1024*1024;
+   static const boost::uint64_t unknown_size = pardecompress_detail::unknown_size;
+
+   // data must stay valid (and unchanged) until this is gone.
+   // num_threads = 0 means one per core.
+   // job_bytes: blocks are handed to the threads in groups of about this much compressed input
+   // (and no more than 4 times that decompressed, when that is known)
+   // max_job_output: a job that comes out bigger is decompressed on one thread instead, from its start
+   parallel_decompress_source( const char* data, size_t len, unsigned num_threads = 0, size_t job_bytes = default_job_bytes,
+         size_t max_job_output = default_max_job_output ) :
+      data(data),
+      len(len),
+      fmt(detect_compression(data, len)),
+      mode(sequential),
+      indexed(false),
+      total_size(0),
+      num_threads(num_threads ? num_threads : boost::thread::hardware_concurrency()),
+      job_bytes(std::max<size_t>(job_bytes, 1)),
+      max_job_output(max_job_output),
+      deliver(0),
+      handed(no_job),
+      skip(0),
+      pos(0),
+      raw_pos(0),
+      member_end(0),
+      workers_done(false),
+      next_job(0),
+      stopping(false),
+      seq_offset(0)
+   {
+      if (this->num_threads == 0)
+         this->num_threads = 1;
+      window = 2*this->num_threads + 1;
+#ifndef CPPCSV_HAVE_ZSTD
+      if (fmt == zstd_compression)
+         throw std::runtime_error("Input is zstd compressed, build with CPPCSV_HAVE_ZSTD to read it");
+#endif
+
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+      if (fmt == gzip_compression)
+      {
+         if (pardecompress_detail::find_bgzf_blocks(p, len, blocks))
+            mode = whole_blocks;
+         else
+         {
+            blocks.clear();
+            pardecompress_detail::find_gzip_members(p, len, blocks);
+            mode = gzip_members;
+         }
+      }
+      else if (fmt == zstd_compression)
+      {
+         if (pardecompress_detail::find_zstd_frames(p, len, blocks))
+            mode = whole_blocks;
+         else
+            blocks.clear();   // decompress_source will say what is wrong with it
+      }
+
+      if (blocks.size() < 2)
+      {
+         mode = sequential;
+         blocks.clear();
+         start_sequential(0);
+         return;
+      }
+      make_jobs();
+      start();
+   }
+
+   ~parallel_decompress_source()
+   {
+      stop();
+   }
+
+   compression format() const { return fmt; }
+
+   // more than one block, decompressed on the threads
+   bool is_parallel() const { return mode != sequential; }
+
+   // the decompressed size of every block is known, so seek() works
+   bool has_block_index() const { return indexed; }
+
+   // for gzip_members, candidates until the block index is known
+   std::vector<compressed_block> const& get_blocks() const { return blocks; }
+
+   // decompressed bytes handed out so far
+   boost::uint64_t position() const { return pos; }
+
+   // of the compressed input
+   boost::uint64_t raw_position() const
+   {
+      if (seq_in)
+         return seq_offset + (seq_ahead ? seq_ahead->raw_position() : seq->raw_position());
+      return raw_pos;
+   }
+
+   // decompressed, 0 if not known (yet)
+   boost::uint64_t size() const
+   {
+      if (fmt == no_compression)
+         return len;
+      return indexed ? total_size : 0;
+   }
+
+   size_t next( const char*& out )
+   {
+      bool fall_back = false;
+      {
+         boost::unique_lock<boost::mutex> lock(mutex);
+         release_handed();
+         while (!seq_in)
+         {
+            if (mode == gzip_members)
+            {
+               // the one that starts where the last member ended, anything before it was not a member
+               while (deliver != jobs.size() && blocks[deliver].offset < member_end)
+                  drop(deliver++);
+               if (member_end == len)
+                  break;
+               if (deliver == jobs.size() || blocks[deliver].offset != member_end) {
+                  fall_back = true;
+                  break;
+               }
+            }
+            else if (deliver == jobs.size())
+            {
+               if (!indexed && !workers_done)
+                  break;   // the block sizes are known now
+               return 0;
+            }
+
+            changed.notify_all();   // the window has moved
+            while (results[deliver].state < job_done)
+               changed.wait(lock);
+
+            job_result & r = results[deliver];
+            if (r.state == job_failed)
+               throw std::runtime_error(r.error);
+            if (r.state == job_too_big) {
+               fall_back = true;
+               break;
+            }
+
+            const compressed_block & first = blocks[jobs[deliver].first_block];
+            if (mode == gzip_members)
+            {
+               pardecompress_detail::add_block(found, static_cast<size_t>(first.offset),
+                     static_cast<size_t>(r.end - first.offset), r.out.size());
+               member_end = r.end;
+            }
+            raw_pos = r.end;
+            handed = deliver++;
+            if (r.out.size() <= skip)
+            {
+               // all before the seek offset (or an empty block)
+               skip -= r.out.size();
+               release_handed();
+               continue;
+            }
+            out = &r.out[skip];
+            const size_t n = r.out.size() - skip;
+            skip = 0;
+            pos += n;
+            return n;
+         }
+      }
+
+      if (!seq_in)
+      {
+         if (!fall_back)
+         {
+            // the end: the block index is known now
+            finish_blocks();
+            return 0;
+         }
+         // carry on from where the last one ended
+         stop();
+         start_sequential(mode == gzip_members ? member_end : static_cast<size_t>(blocks[jobs[deliver].first_block].offset));
+      }
+
+      // after a seek() into a block too big for a job, what is before the offset
+      size_t n;
+      while ((n = seq_ahead ? seq_ahead->next(out) : seq->next(out)) != 0 && n <= skip)
+         skip -= n;
+      if (n != 0)
+      {
+         out += skip;
+         n -= skip;
+      }
+      skip = 0;
+      pos += n;
+      return n;
+   }
+
+   // decompressed offset, needs the block index (or input that is not compressed)
+   bool seek( boost::uint64_t offset )
+   {
+      if (fmt == no_compression)
+      {
+         if (!seq->seek(offset))
+            return false;
+         pos = offset;
+         return true;
+      }
+      if (!indexed || offset > total_size)
+         return false;
+
+      stop();
+      seq_ahead.reset();
+      seq.reset();
+      seq_in.reset();
+
+      // the last job that starts at or before offset
+      size_t lo = 0, hi = jobs.size();
+      while (hi - lo > 1)
+      {
+         const size_t mid = lo + (hi - lo) / 2;
+         if (blocks[jobs[mid].first_block].data_offset <= offset)
+            lo = mid;
+         else
+            hi = mid;
+      }
+      for (size_t i = 0; i != results.size(); ++i)
+      {
+         recycle(results[i].out);
+         results[i].state = job_queued;
+      }
+      const compressed_block & first = blocks[jobs[lo].first_block];
+      deliver = next_job = lo;
+      handed = no_job;
+      skip = static_cast<size_t>(offset - first.data_offset);
+      pos = offset;
+      raw_pos = first.offset;
+      start();
+      return true;
+   }
+
+private:
+   enum layout { sequential, whole_blocks, gzip_members };
+   enum job_state { job_queued, job_done, job_failed, job_too_big };
+   enum { no_job = ~size_t(0) };
+
+   struct job {
+      size_t first_block;
+      size_t end_block;
+   };
+
+   struct job_result {
+      int state;
+      std::vector<char> out;
+      std::string error;
+      boost::uint64_t end;      // compressed offset where it stopped
+   };
+
+   const char* data;
+   size_t len;
+   compression fmt;
+   layout mode;
+   bool indexed;
+   boost::uint64_t total_size;
+   unsigned num_threads;
+   size_t job_bytes;
+   size_t max_job_output;
+   size_t window;                      // jobs the threads can be ahead of next()
+   std::vector<compressed_block> blocks;
+   std::vector<job> jobs;
+
+   // next() only
+   size_t deliver;                     // the job it waits for
+   size_t handed;                      // the job whose out it handed out last
+   size_t skip;                        // what is left to skip to the seek offset
+   boost::uint64_t pos;
+   boost::uint64_t raw_pos;
+   boost::uint64_t member_end;         // gzip_members: where the last one ended
+   bool workers_done;                  // finish_blocks() has been
+   std::vector<compressed_block> found;   // gzip_members: the real ones so far
+
+   // shared with the threads
+   std::vector<job_result> results;
+   std::vector<std::vector<char> > spare;   // buffers to reuse
+   size_t next_job;
+   bool stopping;
+   boost::mutex mutex;
+   boost::condition_variable changed;
+   boost::scoped_ptr<boost::thread_group> workers;
+
+   // one block, or what is left after a block too big for a job: decompressed from the start
+   boost::scoped_ptr<memory_source> seq_in;
+   boost::scoped_ptr<decompress_source> seq;
+   boost::scoped_ptr<prefetch_source> seq_ahead;
+   size_t seq_offset;
+
+   void make_jobs()
+   {
+      jobs.clear();
+      for (size_t b = 0; b != blocks.size(); )
+      {
+         job j = { b, b };
+         boost::uint64_t bytes = 0, data_bytes = 0;
+         do {
+            bytes += blocks[b].size;
+            if (blocks[b].data_size != unknown_size)
+               data_bytes += blocks[b].data_size;
+            ++b;
+         } while (mode == whole_blocks && b != blocks.size() && bytes < job_bytes && data_bytes < 4*job_bytes);
+         j.end_block = b;
+         jobs.push_back(j);
+      }
+
+      job_result empty;
+      empty.state = job_queued;
+      empty.end = 0;
+      results.assign(jobs.size(), empty);
+      update_index();
+   }
+
+   void update_index()
+   {
+      indexed = true;
+      total_size = 0;
+      for (size_t i = 0; i != blocks.size(); ++i)
+      {
+         if (blocks[i].data_size == unknown_size)
+            indexed = false;
+         blocks[i].data_offset = total_size;
+         total_size += blocks[i].data_size;
+      }
+      if (!indexed)
+         total_size = 0;
+   }
+
+   void start()
+   {
+      stopping = false;
+      workers.reset(new boost::thread_group);
+      for (unsigned i = 0; i != num_threads; ++i)
+         workers->create_thread(boost::bind(&parallel_decompress_source::work, this));
+   }
+
+   void stop()
+   {
+      if (!workers)
+         return;
+      {
+         boost::lock_guard<boost::mutex> lock(mutex);
+         stopping = true;
+      }
+      changed.notify_all();
+      workers->join_all();
+      workers.reset();
+   }
+
+   void start_sequential( size_t offset )
+   {
+      seq_offset = offset;
+      seq_in.reset(new memory_source(data + offset, len - offset));
+      seq.reset(new decompress_source(*seq_in));
+      if (offset != 0 && seq->format() != fmt)
+         throw std::runtime_error(std::string("Corrupt ") + compression_name(fmt) + " input: trailing data");
+      if (seq->format() != no_compression)
+         seq_ahead.reset(new prefetch_source(*seq));
+   }
+
+   // everything has been decompressed once, gzip_members have all been found
+   void finish_blocks()
+   {
+      stop();
+      workers_done = true;
+      if (mode == gzip_members)
+      {
+         blocks.swap(found);
+         found.clear();
+         mode = whole_blocks;
+         make_jobs();
+         deliver = next_job = jobs.size();
+      }
+      else
+         update_index();
+      raw_pos = len;
+   }
+
+   // with the mutex
+   void recycle( std::vector<char> & buf )
+   {
+      if (spare.size() < window && buf.capacity() != 0)
+      {
+         spare.push_back(std::vector<char>());
+         spare.back().swap(buf);
+      }
+      std::vector<char>().swap(buf);
+   }
+
+   void release_handed()
+   {
+      if (handed != no_job)
+         recycle(results[handed].out);
+      handed = no_job;
+   }
+
+   // a job that was not a member start after all
+   void drop( size_t j )
+   {
+      if (results[j].state != job_queued)
+         recycle(results[j].out);
+   }
+
+   // decompresses job j into out, returns the compressed offset where it ended
+   boost::uint64_t run_job( size_t j, pardecompress_detail::block_decoder & dec, std::vector<char> & out )
+   {
+      const job & jb = jobs[j];
+      if (mode == gzip_members)
+      {
+         // as far as the member goes, which can be past the next candidate
+         const compressed_block & b = blocks[jb.first_block];
+         const size_t off = static_cast<size_t>(b.offset);
+         return off + dec.gunzip(data + off, len - off, 4*b.size, out, max_job_output);
+      }
+
+      for (size_t i = jb.first_block; i != jb.end_block; ++i)
+      {
+         const compressed_block & b = blocks[i];
+         const char* in = data + static_cast<size_t>(b.offset);
+         const size_t n = static_cast<size_t>(b.size);
+         const size_t before = out.size();
+         const size_t used = (fmt == gzip_compression) ?
+            dec.gunzip(in, n, b.data_size, out, max_job_output) :
+            dec.unzstd(in, n, b.data_size, out, max_job_output);
+         if (used != n)
+            throw std::runtime_error(std::string("Corrupt ") + compression_name(fmt) + " input: block is shorter than its header says");
+         if (b.data_size == unknown_size)
+            blocks[i].data_size = out.size() - before;   // only this thread has block i, next() reads it once the job is done
+      }
+      const compressed_block & last = blocks[jb.end_block - 1];
+      return last.offset + last.size;
+   }
+
+   void work()
+   {
+      pardecompress_detail::block_decoder dec;
+      while (true)
+      {
+         size_t j;
+         std::vector<char> out;
+         {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!stopping && (next_job == jobs.size() || next_job >= deliver + window))
+               changed.wait(lock);
+            if (stopping)
+               return;
+            if (next_job < deliver)
+               next_job = deliver;   // next() skipped those (gzip_members)
+            j = next_job++;
+            if (!spare.empty())
+            {
+               out.swap(spare.back());
+               spare.pop_back();
+            }
+         }
+
+         out.clear();
+         int state = job_done;
+         std::string error;
+         boost::uint64_t end = 0;
+         try {
+            end = run_job(j, dec, out);
+         }
+         catch (pardecompress_detail::too_big const&) {
+            state = job_too_big;
+         }
+         catch (std::exception const& e) {
+            state = job_failed;
+            error = e.what();
+         }
+
+         boost::lock_guard<boost::mutex> lock(mutex);
+         job_result & r = results[j];
+         r.out.swap(out);
+         r.error = error;
+         r.end = end;
+         r.state = state;
+         if (j < deliver)
+            recycle(r.out);   // next() went past it
+         changed.notify_all();
+      }
+   }
+};
+
+
+} // namespace cppcsv
@@ -8,6 +8,9 @@
 #include <cassert>
 #include <cstring>
 #include "csvbase.hpp"
+#include "csvcheckpoint.hpp"
+#include "csvscan.hpp"
+#include "csvstats.hpp"
 
 #include <algorithm>
 #include <string>
@@ -45,11 +48,34 @@ namespace csvFSM {
       NUM_SI
    };
 
+   // Event Indexes (columns in the transition table)
+   // one per ST_Base event handler, in the same order
+   enum EventIdx {
+      EvChar = 0,
+      EvWhitespace,
+      EvQchar,
+      EvSep,
+      EvNewline,
+      EvDosCR,
+      EvComment,
+      NUM_EV
+   };
+
+   // Character classes, see csv_parser::init_char_classes()
+   // a byte is either a plain EventIdx, or one of these which need a closer look
+   enum CharClass {
+      ClassNull = NUM_EV,   // NUL char, when not allowed
+      ClassQcharActive,     // one of several quote chars, depends on trans.active_qchar
+      ClassComment,         // comment char, only a comment at the start of the row
+      ClassSepToken         // first char of a multi-char separator, see Separator_Token
+   };
+
    // State Transitions
    template <class TTrans>
    class ST_Base {
    public:
-      virtual ~ST_Base() {} // to avoid the abstract class delete warning
+      // no destructor: they are never deleted, and without one the shared
+      // csvFSM::States are constant-initialized (no start-up code)
 
       virtual StateIdx Echar( TTrans& t ) const = 0;
       virtual StateIdx Ewhitespace( TTrans& t ) const = 0;
@@ -138,6 +164,22 @@ void call_out_end_full_row(
 
 
 
+// per-row span builders only need begin_row, the rest is done in Trans
+template <class Output>
+void call_out_begin_row( Output & out, per_row_span_tag & )
+{
+   // do nothing
+}
+
+// batch builders too
+template <class Output>
+void call_out_begin_row( Output & out, per_batch_tag & )
+{
+   // do nothing
+}
+
+
+
 
 template <class CsvBuilder>
 class Trans
@@ -149,10 +191,32 @@ class Trans
 public:
   Trans(CsvBuilder &out, bool trim_whitespace, bool collapse_separators ) :
      value(0),
+     cursor(NULL),
      row_file_start_row(0),
      active_qchar(0),
      error_message(NULL),
      out(out),
+     view_ptr(NULL),
+     view_len(0),
+     row_view_len(0),
+     ws_ptr(NULL),
+     ws_contiguous(false),
+     use_views(false),
+     projection_changed(false),
+     skipping(false),
+     skipped_len(0),
+     row_skipped_len(0),
+     max_cell_bytes(0),
+     max_row_bytes(0),
+     shrink_keep_bytes(1024*1024),
+     shrink_after_rows(100),
+     small_rows(0),
+     limited(false),
+     big_buffers(false),
+     row_start(0),
+     row_first(0),
+     batch_max_rows(4096),
+     batch_max_bytes(1024*1024),
      trim_whitespace(trim_whitespace),
      collapse_separators(collapse_separators)
    {
@@ -160,20 +224,49 @@ public:
       // because we don't need the extra string abilities,
       // and I found it slow on GCC 4.8
       //
-      // some initial buffer size
-      cells_buffer.resize(128);
-      whitespace_state.resize(32);
-
-      cells_buffer[0] = 0;
-      whitespace_state[0] = 0;
+      // nothing is allocated until there is something to parse, see start_chunk()
       cells_buffer_len = 0;
       whitespace_state_len = 0;
+#ifdef CPPCSV_STATS
+      sample_every = 0;
+      sample_countdown = 0;
+      timing_row = false;
+#endif
    }
 
+  // back to the start of the input, keeping the settings and the buffers
+  void reset()
+  {
+     value = 0;
+     cursor = NULL;
+     active_qchar = 0;
+     error_message = NULL;
+     cells_buffer_len = 0;
+     whitespace_state_len = 0;
+     cell_offsets.clear();
+     row_start = 0;
+     row_first = 0;
+     row_cells.clear();
+     view_ptr = NULL;
+     view_len = 0;
+     row_view_len = 0;
+     ws_ptr = NULL;
+     ws_contiguous = false;
+     skipping = false;
+     skipped_len = 0;
+     row_skipped_len = 0;
+     small_rows = 0;
+     drop_batch();
+     CPPCSV_STAT(stats = csv_stats(); sample_countdown = sample_every;)
+  }
+
   // this is set before the state change is called,
   // that way the Events do not need to carry their state with them.
   char value;
 
+  // where value came from in the caller's chunk, or NULL if it did not come from there
+  const char* cursor;
+
   size_t row_file_start_row;      // first file row for this row
 
   // active quote character, required in the situation where multiple quote chars are possible
@@ -183,42 +276,217 @@ public:
 public:
   bool row_empty() const {
      // return cells_buffer.empty() && whitespace_state.empty();
-     return cells_buffer_len == 0 && whitespace_state_len == 0;
+     return cells_buffer_len == row_start && whitespace_state_len == 0 && view_len == 0 && row_view_len == 0
+        && skipped_len == 0 && row_skipped_len == 0;
   }
 
   size_t last_cell_length() const {
      assert(is_row_open());
-     return cells_buffer_len - cell_offsets.back();
+     return cells_buffer_len - cell_offsets.back() + view_len + skipped_len;
   }
 
   bool is_row_open() const {
-     return !cell_offsets.empty();
+     return cell_offsets.size() != row_first;
   }
 
   const char* error_message;
 
 
+  // zero-copy: cells are handed out as pointers into the caller's chunk where possible
+  void set_zero_copy( bool on ) {
+     use_views = on && builder_takes_views(out);
+  }
+
+  // projection: only columns with wanted[col] set are collected, empty means all of them,
+  // from the next row
+  void set_projection( std::vector<char> const& w ) {
+     next_wanted = w;
+     projection_changed = true;
+  }
+
+  // see csv_parser::set_limits()
+  void set_limits( size_t max_cell, size_t max_row ) {
+     max_cell_bytes = max_cell;
+     max_row_bytes = max_row;
+     limited = max_cell || max_row;
+  }
+
+  // see csv_parser::set_shrink_policy()
+  void set_shrink_policy( size_t keep_bytes, size_t after_rows ) {
+     shrink_keep_bytes = keep_bytes;
+     shrink_after_rows = after_rows;
+     big_buffers = cells_buffer.size() > keep_bytes || whitespace_state.size() > keep_bytes;
+  }
+
+  // see csv_parser::set_batch_size()
+  void set_batch_size( size_t max_rows, size_t max_bytes ) {
+     batch_max_rows = max_rows ? max_rows : size_t(-1);
+     batch_max_bytes = max_bytes ? max_bytes : size_t(-1);
+  }
+
+  // bytes held by the buffers
+  size_t buffer_capacity() const {
+     return cells_buffer.size() + whitespace_state.size()
+        + cell_offsets.capacity()*sizeof(size_t)
+        + row_cells.capacity()*sizeof(cell_ref) + row_spans.capacity()*sizeof(cell_span)
+        + batch.buffer.capacity()
+        + (batch.cell_offsets.capacity() + batch.row_offsets.capacity() + batch.file_rows.capacity())*sizeof(size_t);
+  }
+
+  // see csv_checkpoint, only between chunks (after end_chunk())
+  void save_state( csv_checkpoint & cp ) const
+  {
+     assert(!view_ptr && !ws_contiguous && row_first == 0);
+     cp.active_qchar = active_qchar;
+     cp.row_file_start_row = row_file_start_row;
+     cp.cells_buffer.assign(cells_buffer.begin(), cells_buffer.begin() + cells_buffer_len);
+     cp.whitespace_state.assign(whitespace_state.begin(), whitespace_state.begin() + whitespace_state_len);
+     cp.cell_offsets.assign(cell_offsets.begin(), cell_offsets.end());
+     cp.span_offsets.clear();
+     cp.span_lens.clear();
+     for (size_t i = 0; i != row_cells.size(); ++i)
+     {
+        assert(!row_cells[i].view);   // copied by keep_row()
+        cp.span_offsets.push_back(row_cells[i].offset == size_t(-1) ? boost::uint64_t(-1) : row_cells[i].offset);
+        cp.span_lens.push_back(row_cells[i].len);
+     }
+     cp.row_view_len = row_view_len;
+     cp.skipping = skipping;
+     cp.skipped_len = skipped_len;
+     cp.row_skipped_len = row_skipped_len;
+     cp.wanted.assign(wanted.begin(), wanted.end());
+     cp.next_wanted.assign(next_wanted.begin(), next_wanted.end());
+     cp.projection_changed = projection_changed;
+  }
+
+  // NOTE: returns true if cp does not make sense
+  bool restore_state( csv_checkpoint const& cp )
+  {
+     // offsets must be in order and inside the buffer
+     for (size_t i = 0; i != cp.cell_offsets.size(); ++i)
+        if (cp.cell_offsets[i] > cp.cells_buffer.size() || (i && cp.cell_offsets[i] < cp.cell_offsets[i-1]))
+           return true;
+     if (cp.span_offsets.size() != cp.span_lens.size())
+        return true;
+     for (size_t i = 0; i != cp.span_offsets.size(); ++i)
+        if (cp.span_offsets[i] != boost::uint64_t(-1) &&
+            (cp.span_offsets[i] > cp.cells_buffer.size() || cp.span_lens[i] > cp.cells_buffer.size() - cp.span_offsets[i]))
+           return true;
+
+     view_ptr = NULL;
+     view_len = 0;
+     ws_ptr = NULL;
+     ws_contiguous = false;
+     cursor = NULL;
+     active_qchar = cp.active_qchar;
+     row_file_start_row = static_cast<size_t>(cp.row_file_start_row);
+
+     if (cp.cells_buffer.size() >= cells_buffer.size())
+        cells_buffer.resize( (cp.cells_buffer.size()+1)*2 );
+     std::copy(cp.cells_buffer.begin(), cp.cells_buffer.end(), cells_buffer.begin());
+     cells_buffer_len = cp.cells_buffer.size();
+     if (cp.whitespace_state.size() >= whitespace_state.size())
+        whitespace_state.resize( (cp.whitespace_state.size()+1)*2 );
+     std::copy(cp.whitespace_state.begin(), cp.whitespace_state.end(), whitespace_state.begin());
+     whitespace_state_len = cp.whitespace_state.size();
+
+     cell_offsets.assign(cp.cell_offsets.begin(), cp.cell_offsets.end());
+     row_start = 0;
+     row_first = 0;
+     drop_batch();
+     row_cells.clear();
+     for (size_t i = 0; i != cp.span_offsets.size(); ++i)
+     {
+        cell_ref c = { NULL, cp.span_offsets[i] == boost::uint64_t(-1) ? size_t(-1) : static_cast<size_t>(cp.span_offsets[i]),
+           static_cast<size_t>(cp.span_lens[i]) };
+        row_cells.push_back(c);
+     }
+
+     row_view_len = static_cast<size_t>(cp.row_view_len);
+     skipping = cp.skipping;
+     skipped_len = static_cast<size_t>(cp.skipped_len);
+     row_skipped_len = static_cast<size_t>(cp.row_skipped_len);
+     wanted.assign(cp.wanted.begin(), cp.wanted.end());
+     next_wanted.assign(cp.next_wanted.begin(), cp.next_wanted.end());
+     projection_changed = cp.projection_changed;
+     return false;
+  }
+
+  // so there is always a buffer to hand out
+  void start_chunk()
+  {
+     if (cells_buffer.empty())
+        cells_buffer.resize(initial_cells_size);
+  }
+
+  // the caller's chunk is about to go away, copy anything still pointing into it
+  void end_chunk()
+  {
+     cursor = NULL;
+     ws_contiguous = false;
+     if (is_row_open())
+        keep_row(out);
+     if (view_ptr)
+        copy_view();
+     end_batch();
+  }
+
+  // per_batch_tag: hands over the rows collected so far
+  void end_batch()
+  {
+     emit_batch(out);
+  }
+
+
 // make public for virtual to call...
 // private:
 
   // adds current character to cell buffer
   void add()
   {
+     if (skipping) {
+        ++skipped_len;
+        return;
+     }
+     if (use_views && extend_view(cursor, 1))
+        return;
      // cells_buffer.push_back(value);
-     if (cells_buffer_len+1 >= cells_buffer.size())
-        cells_buffer.resize( cells_buffer.size()*2 );
+     if (cells_buffer_len+1 >= cells_buffer.size() && !grow_cells(1, true))
+        return;
      cells_buffer[cells_buffer_len] = value;
      ++cells_buffer_len;
      // note: don't bother to null-terminate
      // cells_buffer[cells_buffer_len] = 0;
   }
 
+  // adds a run of plain characters to cell buffer, same as add() for each one
+  void add_run( const char* run, size_t n )
+  {
+     if (skipping) {
+        skipped_len += n;
+        return;
+     }
+     if (use_views && extend_view(run, n))
+        return;
+     append(run, n);
+  }
+
   // whitespace is remembered until we know if we need to add to the output or forget
   void remember_whitespace()
   {
+     if (use_views)
+     {
+        if (whitespace_state_len == 0) {
+           ws_ptr = cursor;
+           ws_contiguous = (cursor != NULL);
+        }
+        else if (cursor != ws_ptr + whitespace_state_len)
+           ws_contiguous = false;
+     }
+
      // whitespace_state.push_back(value);
-     if (whitespace_state_len+1 >= whitespace_state.size())
-        whitespace_state.resize( whitespace_state.size()*2 );
+     if (whitespace_state_len+1 >= whitespace_state.size() && !grow_whitespace())
+        return;
      whitespace_state[whitespace_state_len] = value;
      ++whitespace_state_len;
      // note: don't bother to null-terminate whitespace
@@ -229,10 +497,10 @@ public:
   {
      if (whitespace_state_len > 0)
      {
-        if (cells_buffer_len+whitespace_state_len >= cells_buffer.size())
-           cells_buffer.resize( (cells_buffer.size()+whitespace_state_len)*2 );
-        memcpy(&cells_buffer[cells_buffer_len], &whitespace_state[0], whitespace_state_len);
-        cells_buffer_len += whitespace_state_len;
+        if (skipping)
+           skipped_len += whitespace_state_len;
+        else if (!use_views || !extend_view(ws_contiguous ? ws_ptr : NULL, whitespace_state_len))
+           append(&whitespace_state[0], whitespace_state_len);
         // cells_buffer.append(whitespace_state);
         drop_whitespace();
      }
@@ -244,15 +512,7 @@ public:
      if (whitespace_state_len > 0)
      {
         if (!trim_whitespace)
-        {
-           if (cells_buffer_len+whitespace_state_len >= cells_buffer.size())
-              cells_buffer.resize( (cells_buffer.size()+whitespace_state_len)*2 );
-           // cells_buffer.append(whitespace_state);
-           memcpy(&cells_buffer[cells_buffer_len], &whitespace_state[0], whitespace_state_len);
-           cells_buffer_len += whitespace_state_len;
-           // note: don't bother to null-terminate
-           // cells_buffer[cells_buffer_len] = 0;
-        }
+           add_whitespace();
         drop_whitespace();
      }
   }
@@ -267,7 +527,13 @@ public:
   void begin_row()
   {
      assert(!is_row_open());
-     cell_offsets.push_back(0);
+     cell_offsets.push_back(row_start);
+     if (projection_changed) {
+        wanted.swap(next_wanted);
+        projection_changed = false;
+     }
+     skipping = !wanted.empty() && !column_wanted(0);
+     CPPCSV_STAT(sample_row(); stats_timer timer(builder_timer());)
      call_out_begin_row( out, out );
   }
 
@@ -281,41 +547,72 @@ public:
     // const size_t end_off = cells_buffer.size();
     const size_t end_off = cells_buffer_len;
 
-    cell_offsets.push_back(end_off);
+    if (CPPCSV_UNLIKELY(limited) && over_limit())
+       return;
 
-    if (has_content) {
+    cell_offsets.push_back(end_off);
+    CPPCSV_STAT(count_cell(end_off - start_off + view_len); stats_timer timer(builder_timer());)
+
+    if (skipping) {
+      // not in the projection, the builder sees a NULL cell
+      assert(start_off == end_off && !view_ptr);
+      row_skipped_len += skipped_len;
+      skipped_len = 0;
+      emit_null(out);
+    }
+    else if (has_content) {
       // assert(!cells_buffer.empty());
-      assert(cells_buffer_len != 0);
-      // char* base = &cells_buffer[0];
-      char* base = &cells_buffer[0];
-      call_out_cell( out, out, base+start_off, end_off-start_off );
+      assert(cells_buffer_len != 0 || view_len != 0 || row_view_len != 0);
+      if (view_ptr) {
+         assert(start_off == end_off);
+         emit_view(out);
+      } else {
+         // char* base = &cells_buffer[0];
+         char* base = &cells_buffer[0];
+         emit_buffered(out, base+start_off, start_off, end_off-start_off);
+      }
     } else {
       assert(start_off == end_off);
       assert(last_cell_length() == 0);
-      call_out_cell(out, out);
+      emit_null(out);
     }
+
+    if (!wanted.empty())
+       skipping = !column_wanted(cell_offsets.size()-1-row_first);
   }
 
   void end_row()
   {
      assert(is_row_open());
+     if (error_message)
+        return;   // eg over a limit in next_cell()
 
      // give client a NON-CONST buffer
      // so they can modify in-place for better efficiency
      // char * buffer = (cells_buffer.empty() ? NULL : &cells_buffer[0]);
      char * buffer = &cells_buffer[0];
 
-     call_out_end_full_row(
-           out, out,
-           buffer,                  // buffer
-           cell_offsets.size()-1,   // num cells
-           &cell_offsets[0],        // offsets
-           row_file_start_row       // first file row for this row
-           );
+     CPPCSV_STAT(count_row(cells_buffer_len - row_start + row_view_len);)
+     {
+        CPPCSV_STAT(stats_timer timer(builder_timer());)
+        emit_row(
+              out,
+              buffer,                  // buffer
+              cell_offsets.size()-1,   // num cells
+              &cell_offsets[0],        // offsets
+              row_file_start_row       // first file row for this row
+              );
+     }
+
+     if (big_buffers)
+        after_big_buffers();
 
-     cell_offsets.clear();
-     // cells_buffer.clear();
-     cells_buffer_len = 0;
+     next_row(out);
+     row_view_len = 0;
+     skipping = false;
+     skipped_len = 0;
+     row_skipped_len = 0;
+     drop_whitespace();   // whitespace remembered at the end of a row must not leak into the next
      // note: don't bother to null-terminate
   }
 
@@ -323,13 +620,420 @@ public:
 
   std::vector<char> cells_buffer;
   std::vector<char> whitespace_state;
-  unsigned int cells_buffer_len;
-  unsigned int whitespace_state_len;
+  size_t cells_buffer_len;
+  size_t whitespace_state_len;
 
   // std::string cells_buffer;
   // std::string whitespace_state;
   std::vector<size_t> cell_offsets;
 
+#ifdef CPPCSV_STATS
+  // see csv_parser::stats(), the counts that come from the FSM are kept there
+  csv_stats stats;
+  size_t sample_every;      // time the builder calls of every n-th row, 0 for none
+  size_t sample_countdown;
+  bool timing_row;          // this row is one of them
+
+  void sample_row() {
+     timing_row = sample_every && --sample_countdown == 0;
+     if (timing_row) {
+        sample_countdown = sample_every;
+        ++stats.sampled_rows;
+     }
+  }
+
+  boost::uint64_t* builder_timer() {
+     return timing_row ? &stats.sampled_builder_ns : NULL;
+  }
+
+  void count_cell( size_t len ) {
+     ++stats.cells;
+     stats.max_cell_bytes = std::max<boost::uint64_t>(stats.max_cell_bytes, len);
+  }
+
+  void count_row( size_t len ) {
+     ++stats.rows;
+     stats.max_row_bytes = std::max<boost::uint64_t>(stats.max_row_bytes, len);
+  }
+#endif
+
+private:
+  // the current cell, while it is still one contiguous piece of the caller's chunk
+  const char* view_ptr;
+  size_t view_len;
+  size_t row_view_len;      // bytes of this row handed out as views, for row_empty()
+
+  // where the remembered whitespace is in the caller's chunk, if it is all there
+  const char* ws_ptr;
+  bool ws_contiguous;
+
+  bool use_views;
+
+  // projection, see set_projection()
+  std::vector<char> wanted;
+  std::vector<char> next_wanted;
+  bool projection_changed;
+  bool skipping;            // the current cell is not wanted
+  size_t skipped_len;       // bytes of the current cell that were not collected
+  size_t row_skipped_len;   // and of the rest of the row, for row_empty()
+
+  enum { initial_cells_size = 128, initial_whitespace_size = 32 };
+
+  // memory, see csv_parser::set_limits() and set_shrink_policy()
+  size_t max_cell_bytes;
+  size_t max_row_bytes;
+  size_t shrink_keep_bytes;
+  size_t shrink_after_rows;
+  size_t small_rows;        // one after another that fit in shrink_keep_bytes
+  bool limited;             // either max is set
+  bool big_buffers;         // grown past shrink_keep_bytes
+
+  // makes room for n more bytes in cells_buffer,
+  // NOTE: returns false (and sets error_message) if that would be over a limit.
+  // in_cell: the bytes are for the current cell (not keep_row())
+  CPPCSV_NOINLINE bool grow_cells( size_t n, bool in_cell )
+  {
+     const size_t need = cells_buffer_len + n;
+     if (max_row_bytes && need - row_start + row_view_len > max_row_bytes) {
+        error_message = "row too long";
+        return false;
+     }
+     if (in_cell && max_cell_bytes && need - cell_offsets.back() > max_cell_bytes) {
+        error_message = "cell too long";
+        return false;
+     }
+     cells_buffer.resize( std::max<size_t>((cells_buffer.size()+n)*2, initial_cells_size) );
+     CPPCSV_STAT(++stats.buffer_growths;)
+     big_buffers = big_buffers || cells_buffer.size() > shrink_keep_bytes;
+     return true;
+  }
+
+  // whitespace is part of a cell, if it is kept
+  CPPCSV_NOINLINE bool grow_whitespace()
+  {
+     if (max_cell_bytes && whitespace_state_len+1 > max_cell_bytes) {
+        error_message = "cell too long";
+        return false;
+     }
+     whitespace_state.resize( std::max<size_t>(whitespace_state.size()*2, initial_whitespace_size) );
+     CPPCSV_STAT(++stats.buffer_growths;)
+     big_buffers = big_buffers || whitespace_state.size() > shrink_keep_bytes;
+     return true;
+  }
+
+  // the current cell and row, counting views but not skipped columns
+  CPPCSV_NOINLINE bool over_limit()
+  {
+     const size_t cell = cells_buffer_len - cell_offsets.back() + view_len;
+     if (max_row_bytes && cells_buffer_len - row_start + row_view_len + view_len > max_row_bytes)
+        error_message = "row too long";
+     else if (max_cell_bytes && cell > max_cell_bytes)
+        error_message = "cell too long";
+     return error_message != NULL;
+  }
+
+  // A big row grew the buffers, give the memory back once the rows are small again,
+  // but not if big rows keep coming.
+  CPPCSV_NOINLINE void after_big_buffers()
+  {
+     if (!batch.file_rows.empty())
+        return;   // the buffers hold a batch, the builder can swap them out instead, see emit_batch()
+     if (cells_buffer_len + cell_offsets.size()*sizeof(size_t) > shrink_keep_bytes) {
+        small_rows = 0;
+        return;
+     }
+     if (++small_rows < shrink_after_rows)
+        return;
+     small_rows = 0;
+     big_buffers = false;
+     std::vector<char>(initial_cells_size).swap(cells_buffer);
+     std::vector<char>(initial_whitespace_size).swap(whitespace_state);
+     std::vector<size_t>().swap(cell_offsets);
+     std::vector<cell_ref>().swap(row_cells);
+     std::vector<cell_span>().swap(row_spans);
+  }
+
+  bool column_wanted( size_t col ) const
+  {
+     return col < wanted.size() && wanted[col];
+  }
+
+  // per_row_span_tag: cells of the open row, see emit_row()
+  struct cell_ref {
+     const char* view;   // into the caller's chunk, or NULL
+     size_t offset;      // into cells_buffer if view is NULL, npos for a NULL cell
+     size_t len;
+  };
+  std::vector<cell_ref> row_cells;
+  std::vector<cell_span> row_spans;
+
+  // per_batch_tag: the finished rows stay in cells_buffer and cell_offsets,
+  // and the open row starts after them, see next_row()
+  size_t row_start;      // in cells_buffer
+  size_t row_first;      // in cell_offsets
+  csv_batch batch;       // row_offsets and file_rows of the rows so far, and the spare buffers
+  size_t batch_max_rows;
+  size_t batch_max_bytes;
+
+  // tries to add the n bytes at p (in the caller's chunk) as part of a view,
+  // returns false if they must be copied instead. Only called if use_views.
+  bool extend_view( const char* p, size_t n )
+  {
+     if (view_ptr && p == view_ptr + view_len)
+     {
+        view_len += n;
+        return true;
+     }
+     return start_view(p, n);
+  }
+
+  // kept out of line, so add() stays small enough to inline
+  CPPCSV_NOINLINE bool start_view( const char* p, size_t n )
+  {
+     if (view_ptr)
+     {
+        // not contiguous, eg an escaped quote, so the cell has to be copied after all
+        copy_view();
+        return false;
+     }
+     if (p && cells_buffer_len == cell_offsets.back())
+     {
+        view_ptr = p;
+        view_len = n;
+        return true;
+     }
+     return false;
+  }
+
+  void append( const char* p, size_t n, bool in_cell = true )
+  {
+     if (cells_buffer_len+n >= cells_buffer.size() && !grow_cells(n, in_cell))
+        return;
+     memcpy(&cells_buffer[cells_buffer_len], p, n);
+     cells_buffer_len += n;
+     // note: don't bother to null-terminate
+  }
+
+  // moves the current cell's view into cells_buffer
+  void copy_view()
+  {
+     const char* p = view_ptr;
+     const size_t n = view_len;
+     view_ptr = NULL;
+     view_len = 0;
+     append(p, n);
+  }
+
+
+public:
+  // which of the builder interfaces is used, for csv_checkpoint
+  unsigned char builder_kind() const { return builder_kind(out); }
+
+private:
+  static unsigned char builder_kind( per_cell_tag& ) { return 0; }
+  static unsigned char builder_kind( per_row_tag& ) { return 1; }
+  static unsigned char builder_kind( per_row_span_tag& ) { return 2; }
+  static unsigned char builder_kind( per_batch_tag& ) { return 3; }
+
+  static bool builder_takes_views( per_cell_tag& ) { return true; }
+  static bool builder_takes_views( per_row_tag& ) { return false; }  // end_full_row() needs one buffer
+  static bool builder_takes_views( per_row_span_tag& ) { return true; }
+  static bool builder_takes_views( per_batch_tag& ) { return false; }   // the batch is cells_buffer
+
+  void emit_view( per_cell_tag& )
+  {
+     call_out_cell( out, out, view_ptr, view_len );
+     row_view_len += view_len;
+     view_ptr = NULL;
+     view_len = 0;
+  }
+
+  void emit_view( per_row_span_tag& )
+  {
+     cell_ref c = { view_ptr, 0, view_len };
+     row_cells.push_back(c);
+     row_view_len += view_len;
+     view_ptr = NULL;
+     view_len = 0;
+  }
+
+  void emit_view( per_row_tag& )
+  {
+     assert(false);   // never uses views
+  }
+
+  void emit_view( per_batch_tag& )
+  {
+     assert(false);
+  }
+
+  void emit_buffered( per_cell_tag&, char* buf, size_t, size_t len )
+  {
+     call_out_cell( out, out, buf, len );
+  }
+
+  void emit_buffered( per_row_tag&, char*, size_t, size_t ) {}
+  void emit_buffered( per_batch_tag&, char*, size_t, size_t ) {}
+
+  void emit_buffered( per_row_span_tag&, char*, size_t offset, size_t len )
+  {
+     cell_ref c = { NULL, offset, len };
+     row_cells.push_back(c);
+  }
+
+  void emit_null( per_cell_tag& )
+  {
+     call_out_cell( out, out );
+  }
+
+  void emit_null( per_row_tag& ) {}
+  void emit_null( per_batch_tag& ) {}
+
+  void emit_null( per_row_span_tag& )
+  {
+     cell_ref c = { NULL, size_t(-1), 0 };
+     row_cells.push_back(c);
+  }
+
+  void emit_row( per_cell_tag&, char* buffer, size_t num_cells, const size_t* offsets, size_t file_row )
+  {
+     call_out_end_full_row( out, out, buffer, num_cells, offsets, file_row );
+  }
+
+  void emit_row( per_row_tag&, char* buffer, size_t num_cells, const size_t* offsets, size_t file_row )
+  {
+     call_out_end_full_row( out, out, buffer, num_cells, offsets, file_row );
+  }
+
+  void emit_row( per_row_span_tag&, char* buffer, size_t num_cells, const size_t*, size_t file_row )
+  {
+     assert(num_cells == row_cells.size());
+     row_spans.resize(num_cells);
+     for (size_t i = 0; i != num_cells; ++i)
+     {
+        cell_ref const& c = row_cells[i];
+        row_spans[i].data = c.view ? c.view : (c.offset == size_t(-1) ? NULL : buffer + c.offset);
+        row_spans[i].len = c.len;
+     }
+     out.end_full_row( num_cells ? &row_spans[0] : NULL, num_cells, file_row );
+     row_cells.clear();
+  }
+
+  // the row stays where it is, next_row() starts the next one after it
+  void emit_row( per_batch_tag&, char*, size_t, const size_t*, size_t file_row )
+  {
+     if (batch.row_offsets.empty())
+        batch.row_offsets.push_back(0);
+     batch.row_offsets.push_back(cell_offsets.size());
+     batch.file_rows.push_back(file_row);
+  }
+
+  // ready for the next row
+  void next_row( per_cell_tag& ) { clear_row(); }
+  void next_row( per_row_tag& ) { clear_row(); }
+  void next_row( per_row_span_tag& ) { clear_row(); }
+
+  void next_row( per_batch_tag& )
+  {
+     row_start = cells_buffer_len;
+     row_first = cell_offsets.size();
+     if (batch.file_rows.size() >= batch_max_rows || row_start >= batch_max_bytes)
+        emit_batch(out);
+  }
+
+  void clear_row()
+  {
+     cell_offsets.clear();
+     // cells_buffer.clear();
+     cells_buffer_len = 0;
+  }
+
+  void emit_batch( per_cell_tag& ) {}
+  void emit_batch( per_row_tag& ) {}
+  void emit_batch( per_row_span_tag& ) {}
+
+  // Hands the builder cells_buffer and cell_offsets as they are, and carries on with the spare ones,
+  // only the open row (at the end of a chunk) is copied over.
+  void emit_batch( per_batch_tag& )
+  {
+     if (batch.file_rows.empty())
+        return;
+
+     batch.buffer.swap(cells_buffer);
+     batch.cell_offsets.swap(cell_offsets);
+     cell_offsets.clear();
+
+     const size_t open_len = cells_buffer_len - row_start;
+     if (cells_buffer.size() <= open_len || cells_buffer.size() < initial_cells_size)
+        cells_buffer.resize( std::max<size_t>(open_len*2, initial_cells_size) );
+     if (open_len)
+        memcpy(&cells_buffer[0], &batch.buffer[row_start], open_len);
+     for (size_t i = row_first; i != batch.cell_offsets.size(); ++i)
+        cell_offsets.push_back(batch.cell_offsets[i] - row_start);
+     batch.cell_offsets.resize(row_first);
+     cells_buffer_len = open_len;
+     row_start = 0;
+     row_first = 0;
+
+     {
+        CPPCSV_STAT(stats_timer timer(builder_timer());)
+        out.end_full_rows(batch);
+     }
+     batch.cell_offsets.clear();
+     batch.row_offsets.clear();
+     batch.file_rows.clear();
+  }
+
+  // forgets the rows so far, the caller has already cleared cells_buffer and cell_offsets
+  void drop_batch()
+  {
+     batch.cell_offsets.clear();
+     batch.row_offsets.clear();
+     batch.file_rows.clear();
+  }
+
+  // the row continues in the next chunk, copy the finished cells that are still views
+  void keep_row( per_cell_tag& ) {}
+  void keep_row( per_row_tag& ) {}
+  void keep_row( per_batch_tag& ) {}
+
+  void keep_row( per_row_span_tag& )
+  {
+     size_t i = 0;
+     while (i != row_cells.size() && !row_cells[i].view)
+        ++i;
+     if (i == row_cells.size())
+        return;
+
+     // the current cell's copied bytes are at the end of cells_buffer,
+     // copy them again after the finished cells
+     const size_t cur_start = cell_offsets.back();
+     const size_t cur_len = cells_buffer_len - cur_start;
+
+     for (; i != row_cells.size(); ++i)
+     {
+        cell_ref & c = row_cells[i];
+        if (c.view)
+        {
+           c.offset = cells_buffer_len;
+           row_view_len -= c.len;   // counted in cells_buffer_len now
+           append(c.view, c.len, false);
+           c.view = NULL;
+        }
+     }
+
+     const size_t new_start = cells_buffer_len;
+     if (cur_len > 0)
+     {
+        if (cells_buffer_len+cur_len >= cells_buffer.size() && !grow_cells(cur_len, false))
+           return;
+        memcpy(&cells_buffer[new_start], &cells_buffer[cur_start], cur_len);
+        cells_buffer_len += cur_len;
+     }
+     cell_offsets.back() = new_start;
+  }
+
+public:
   bool trim_whitespace;
   bool collapse_separators;
 };
@@ -511,6 +1215,55 @@ public:
 #undef REDIRECT
 #undef TTS
 
+
+// The states have no data, so every parser shares one set (built at compile time)
+template <class TTrans>
+struct States {
+   static const ST_Start<TTrans> start;
+   static const ST_ReadSkipPre<TTrans> read_skip_pre;
+   static const ST_ReadQuoted<TTrans> read_quoted;
+   static const ST_ReadQuotedCheckEscape<TTrans> read_quoted_check_escape;
+   static const ST_ReadQuotedSkipPost<TTrans> read_quoted_skip_post;
+   static const ST_ReadDosCR<TTrans> read_dos_cr;
+   static const ST_ReadQuotedDosCR<TTrans> read_quoted_dos_cr;
+   static const ST_ReadUnquoted<TTrans> read_unquoted;
+   static const ST_ReadUnquotedWhitespace<TTrans> read_unquoted_whitespace;
+   static const ST_ReadComment<TTrans> read_comment;
+   static const ST_ReadError<TTrans> read_error;
+
+   // by StateIdx
+   static const ST_Base<TTrans>* const all[NUM_SI];
+};
+
+template <class TTrans> const ST_Start<TTrans> States<TTrans>::start;
+template <class TTrans> const ST_ReadSkipPre<TTrans> States<TTrans>::read_skip_pre;
+template <class TTrans> const ST_ReadQuoted<TTrans> States<TTrans>::read_quoted;
+template <class TTrans> const ST_ReadQuotedCheckEscape<TTrans> States<TTrans>::read_quoted_check_escape;
+template <class TTrans> const ST_ReadQuotedSkipPost<TTrans> States<TTrans>::read_quoted_skip_post;
+template <class TTrans> const ST_ReadDosCR<TTrans> States<TTrans>::read_dos_cr;
+template <class TTrans> const ST_ReadQuotedDosCR<TTrans> States<TTrans>::read_quoted_dos_cr;
+template <class TTrans> const ST_ReadUnquoted<TTrans> States<TTrans>::read_unquoted;
+template <class TTrans> const ST_ReadUnquotedWhitespace<TTrans> States<TTrans>::read_unquoted_whitespace;
+template <class TTrans> const ST_ReadComment<TTrans> States<TTrans>::read_comment;
+template <class TTrans> const ST_ReadError<TTrans> States<TTrans>::read_error;
+
+template <class TTrans>
+const ST_Base<TTrans>* const States<TTrans>::all[NUM_SI] = {
+   &States<TTrans>::start,
+   &States<TTrans>::read_skip_pre,
+   &States<TTrans>::read_quoted,
+   &States<TTrans>::read_quoted_check_escape,
+   &States<TTrans>::read_quoted_skip_post,
+   &States<TTrans>::read_dos_cr,
+   &States<TTrans>::read_quoted_dos_cr,
+   &States<TTrans>::read_unquoted,
+   &States<TTrans>::read_unquoted_whitespace,
+   &States<TTrans>::read_comment,
+   &States<TTrans>::read_error
+};
+
+
+
 } // namespace csvFSM
 
 
@@ -532,6 +1285,32 @@ public:
 struct Disable {};
 struct Separator_Comma {};
 
+// A single char fixed at compile time, eg csv_parser<Builder,Quote<'"'>,Sep<'\t'>,Comment<'#'> >,
+// in any combination with Disable and Separator_Comma.
+// When all three are fixed, the chars that end a run of cell content are compile-time
+// constants too, see csv_parser::static_dialect.
+template <char C> struct Sep {};
+template <char C> struct Quote {};
+template <char C> struct Comment {};
+
+// A separator of more than one char, eg csv_parser<Builder,char,Separator_Token>(builder, '"', Separator_Token("||")).
+// It is only a separator where the whole token is, so "a|b||c" is the cells "a|b" and "c".
+// It must not have newlines or CRs in it, or start with a quote char.
+struct Separator_Token {
+   std::string token;
+
+   Separator_Token() {}
+   explicit Separator_Token( std::string const& token ) : token(token) {}
+   explicit Separator_Token( const char* token ) : token(token) {}
+};
+
+// the char for a fixed dialect type, 0 for none
+template <class T> struct static_char { static const bool is_static = false; static const char value = 0; };
+template <> struct static_char<Disable> { static const bool is_static = true; static const char value = 0; };
+template <> struct static_char<Separator_Comma> { static const bool is_static = true; static const char value = ','; };
+template <char C> struct static_char< Sep<C> > { static const bool is_static = true; static const char value = C; };
+template <char C> struct static_char< Quote<C> > { static const bool is_static = true; static const char value = C; };
+template <char C> struct static_char< Comment<C> > { static const bool is_static = true; static const char value = C; };
 
 // support pre-C++11
 template <class A, class B>
@@ -541,6 +1320,33 @@ template <class A>
 struct my_is_same<A,A> { static const bool value = true; };
 
 
+// All the csv_parser constructor options in one copyable struct,
+// for code that makes its own parsers (eg parallel_csv_parser)
+template <class QuoteChars = char, class Separators = char, class CommentChars = char>
+struct csv_dialect
+{
+   QuoteChars qchar;
+   Separators sep;
+   bool trim_whitespace;
+   bool collapse_separators;
+   CommentChars comment;
+   bool comments_must_be_at_start_of_line;
+   bool collect_error_context;
+   AllowNullCharPolicy allow_null_char;
+
+   csv_dialect(QuoteChars qchar, Separators sep, bool trim_whitespace = false, bool collapse_separators = false, CommentChars comment = CommentChars(), bool comments_must_be_at_start_of_line = true, bool collect_error_context = false, AllowNullCharPolicy allow_null_char = DoAllowNullChars)
+    : qchar(qchar), sep(sep),
+      trim_whitespace(trim_whitespace),
+      collapse_separators(collapse_separators),
+      comment(comment),
+      comments_must_be_at_start_of_line(comments_must_be_at_start_of_line),
+      collect_error_context(collect_error_context),
+      allow_null_char(allow_null_char)
+   {
+   }
+};
+
+
 template <class CsvBuilder, class QuoteChars = char, class Separators = char, class CommentChars = char>
 class csv_parser
 {
@@ -557,6 +1363,15 @@ public:
       my_is_same<CommentChars, Disable>::value
       ;
 
+   // quote, separator and comment chars are all fixed at compile time (see Sep<> etc)
+   static const bool static_dialect =
+      static_char<QuoteChars>::is_static
+      &&
+      static_char<Separators>::is_static
+      &&
+      static_char<CommentChars>::is_static
+      ;
+
    // static const bool builder_supported = csvFSM::BuilderSupported<CsvBuilder>::ok;
 
    typedef csvFSM::Trans<CsvBuilder> MyTrans;
@@ -575,24 +1390,47 @@ csv_parser(CsvBuilder &out, QuoteChars qchar, Separators sep, bool trim_whitespa
    allow_null_char(allow_null_char),
    errmsg(NULL),
    collect_error_context(false),
+   input_offset(0),
    trans(out, trim_whitespace, collapse_separators)
 {
    init_states();
+   init_char_classes();
    reset_cursor_location();
 }
 
 
-// construct for fast-path (no quotes, comments, fixed char separator
-csv_parser(CsvBuilder &out, bool trim_whitespace = false, bool collapse_separators = false, AllowNullCharPolicy allow_null_char = DoAllowNullChars)
+// same as above, for string literals: without this, "\"'" and ";," would convert
+// to bool and silently pick the fast-path constructor below
+csv_parser(CsvBuilder &out, const char* qchar, const char* sep, bool trim_whitespace = false, bool collapse_separators = false, AllowNullCharPolicy allow_null_char = DoAllowNullChars)
  : qchar(qchar), sep(sep),
    comment(),  // inits comment char to zero if char
    comments_must_be_at_start_of_line(true),
    allow_null_char(allow_null_char),
    errmsg(NULL),
    collect_error_context(false),
+   input_offset(0),
    trans(out, trim_whitespace, collapse_separators)
 {
    init_states();
+   init_char_classes();
+   reset_cursor_location();
+}
+
+
+// construct for fast-path (no quotes, comments, fixed char separator),
+// or any other dialect fixed at compile time
+csv_parser(CsvBuilder &out, bool trim_whitespace = false, bool collapse_separators = false, AllowNullCharPolicy allow_null_char = DoAllowNullChars)
+ : qchar(), sep(),
+   comment(),  // inits comment char to zero if char
+   comments_must_be_at_start_of_line(true),
+   allow_null_char(allow_null_char),
+   errmsg(NULL),
+   collect_error_context(false),
+   input_offset(0),
+   trans(out, trim_whitespace, collapse_separators)
+{
+   init_states();
+   init_char_classes();
    reset_cursor_location();
 }
 
@@ -600,26 +1438,38 @@ csv_parser(CsvBuilder &out, bool trim_whitespace = false, bool collapse_separato
 
 
 // constructor with everything
-// note: collect_error_context adds a small amount of overhead
+// note: collect_error_context costs very little, the current row is only copied at the end of each chunk
 csv_parser(CsvBuilder &out, QuoteChars qchar, Separators sep, bool trim_whitespace, bool collapse_separators, CommentChars comment, bool comments_must_be_at_start_of_line, bool collect_error_context = false, AllowNullCharPolicy allow_null_char = DoAllowNullChars)
  : qchar(qchar), sep(sep), comment(comment),
    comments_must_be_at_start_of_line(comments_must_be_at_start_of_line),
    allow_null_char(allow_null_char),
    errmsg(NULL),
    collect_error_context(collect_error_context),
+   input_offset(0),
    trans(out, trim_whitespace, collapse_separators)
 {
    init_states();
+   init_char_classes();
+   reset_cursor_location();
+}
+
+
+// constructor from a dialect
+csv_parser(CsvBuilder &out, csv_dialect<QuoteChars,Separators,CommentChars> const& d)
+ : qchar(d.qchar), sep(d.sep), comment(d.comment),
+   comments_must_be_at_start_of_line(d.comments_must_be_at_start_of_line),
+   allow_null_char(d.allow_null_char),
+   errmsg(NULL),
+   collect_error_context(d.collect_error_context),
+   input_offset(0),
+   trans(out, d.trim_whitespace, d.collapse_separators)
+{
+   init_states();
+   init_char_classes();
    reset_cursor_location();
 }
 
 
-  ~csv_parser()
-  {
-     for (int i = 0; i < csvFSM::NUM_SI; ++i)
-        delete state_trans[i];
-  }
-  
   // NOTE: returns true on error
 bool operator()(const std::string &line) // not required to be linewise
 {
@@ -636,123 +1486,261 @@ bool operator()(const char *&buf, size_t len)
 void reset_cursor_location()
 {
    current_row = 1;     // start at one, as we post-increment
-   current_column = 0;  // start at zero, as we pre-increment
+   current_column = 0;  // start at zero, counts the chars read on this row
    trans.row_file_start_row = current_row;
 }
 
 
+// Gets the parser ready for a new input, as if it had just been constructed,
+// but keeps its settings (zero-copy, projection, limits) and the buffers it has grown.
+// Parsing lots of small inputs with one parser this way allocates nothing after the first few.
+void reset()
+{
+   trans.reset();
+   state_idx = csvFSM::Start;
+   errmsg = NULL;
+   input_offset = 0;
+   current_row_content.clear();
+   token_carry.clear();
+   reset_cursor_location();
+   CPPCSV_STAT(memset(transitions, 0, sizeof(transitions));)
+}
+
+
 size_t get_current_row() const
 {
    return current_row;
 }
 
 
+// note: only brought up to date at the end of each chunk, so it is not exact when called from the builder
 size_t get_current_column() const
 {
    return current_column;
 }
 
 
+// For parsing part of the input (see csvparallel.hpp), starting just after a newline.
+// The parser is left as if it had already read row-1 lines and was at the start of row.
+void resume_at_row( size_t row )
+{
+   assert(row > 1);
+   assert(state_idx == csvFSM::Start && !trans.is_row_open());
+   current_row = row;
+   current_column = 0;
+   current_row_content.clear();
+   trans.row_file_start_row = row-1;   // as set by the newline we did not see
+}
 
-bool process_chunk(const std::string &line) // not required to be linewise
+// As above, but in the middle of a cell quoted with q, that has a newline in it.
+// Cells before it on the same row are unknown, so the first row emitted will be wrong.
+void resume_inside_quotes( size_t row, char q )
 {
-  const char *buf=line.c_str();
-  return process_chunk(buf,line.size());
+   resume_at_row(row);
+   state_idx = csvFSM::ReadQuoted;
+   trans.begin_row();
+   trans.active_qchar = q;
+   trans.value = '\n';
+   trans.add();
 }
 
+// The parser is between rows, and not inside a comment,
+// so what follows can be parsed without knowing what came before.
+bool at_row_boundary() const
+{
+   return state_idx == csvFSM::Start && !trans.is_row_open() && token_carry.empty();
+}
 
+bool is_quote_char( char c ) const
+{
+   const unsigned char cls = char_class[static_cast<unsigned char>(c)];
+   return cls == csvFSM::EvQchar || cls == csvFSM::ClassQcharActive;
+}
 
-// note: call this like so
-// const char* temp = bufptr;
-// process_chunk(temp,len);
-// if there is an error, then temp is at the character that caused the problem.
-bool process_chunk(const char *&buf, const size_t len)
+// the byte table's class for c, a csvFSM::EventIdx or csvFSM::CharClass,
+// for code that follows the same rules without running the state machine (see csvcount.hpp)
+unsigned char char_class_of( char c ) const
 {
-  char const * const buf_end = buf + len;
+   return char_class[static_cast<unsigned char>(c)];
+}
 
-  for ( ; buf != buf_end; ++buf ) {
-     // note: current character is written directly to trans,
-     // so that events become empty structs.
-     trans.value = *buf;
-     ++current_column;
-     if (collect_error_context)
-        current_row_content.push_back(*buf);
 
-     using namespace csvFSM;
+// Checkpoints, see csvcheckpoint.hpp. Only between process_chunk() calls.
+// NOTE: returns true on error (there is no checkpoint after a parse error)
+bool get_checkpoint( csv_checkpoint & cp ) const
+{
+   if (trans.error_message)
+      return true;
+   cp.dialect_hash = dialect_hash();
+   cp.input_offset = input_offset;
+   cp.current_row = current_row;
+   cp.current_column = current_column;
+   cp.current_row_content = current_row_content;
+   cp.state_idx = static_cast<unsigned char>(state_idx);
+   cp.token_carry = token_carry;
+   trans.save_state(cp);
+   return false;
+}
 
-     switch (trans.value)
-     {
-        case '\r': {
-                state_idx = (state_trans[state_idx]->Edos_cr(trans));
-                break;
-             }
+// Carries on from a checkpoint, the next process_chunk() should start at cp.input_offset.
+// NOTE: returns true on error, if cp came from a parser with a different dialect
+// or kind of builder, or does not make sense.  The parser is unchanged then.
+bool restore_checkpoint( csv_checkpoint const& cp )
+{
+   using namespace csvFSM;
+   if (cp.dialect_hash != dialect_hash() || cp.state_idx >= ReadError)
+      return true;
 
-        case '\n': {
-                trans.row_file_start_row = current_row;
-                state_idx = (state_trans[state_idx]->Enewline(trans));
-                if (collect_error_context)
-                   current_row_content.clear();
-                ++current_row;
-                current_column = 0;
-                break;
-             }
+   // these states are between rows, the others are in one (ReadDosCR can be either)
+   const bool between_rows = cp.state_idx == Start || cp.state_idx == ReadComment;
+   if (cp.state_idx != ReadDosCR && between_rows != cp.cell_offsets.empty())
+      return true;
 
-        default: {
-                if (allow_null_char != DoAllowNullChars && trans.value == '\0') {
-                   trans.error_message = "Unexpected NULL character"; // check for NULL character
-                }
+   if (trans.restore_state(cp))
+      return true;
+   trans.error_message = NULL;
+   state_idx = static_cast<StateIdx>(cp.state_idx);
+   input_offset = cp.input_offset;
+   current_row = static_cast<size_t>(cp.current_row);
+   current_column = static_cast<size_t>(cp.current_column);
+   current_row_content = cp.current_row_content;
+   token_carry = cp.token_carry;
+   return false;
+}
 
-                else if (!FAST_commas_no_quotes_no_comments && is_quote_char(qchar)) {
-                   state_idx = (state_trans[state_idx]->Eqchar(trans));
-                }
 
-                else if (!FAST_commas_no_quotes_no_comments && match_char(sep)) {
-                   state_idx = (state_trans[state_idx]->Esep(trans));
-                }
+// Zero-copy mode: cells are handed to the builder as pointers into the chunk
+// given to process_chunk(), and only copied when they have to be
+// (they continue into the next chunk, or have escaped quotes or CRs removed).
+// Pointers are only valid during the builder call.
+// Works for per-cell and per_row_span_tag builders, per_row_tag and per_batch_tag builders always get a copy
+// (for per_batch_tag, the one copy into the batch).
+void set_zero_copy( bool on )
+{
+   trans.set_zero_copy(on);
+}
 
-                else if (!FAST_commas_no_quotes_no_comments && (!comments_must_be_at_start_of_line || trans.row_empty()) && match_char(comment)) {
-                   // this one is more complex gate...
-                   // only emit a comment event if comments can be anywhere or
-                   // the row is still empty
-                   state_idx = (state_trans[state_idx]->Ecomment(trans));
-                }
 
-                else
-                {
-                   switch (trans.value)
-                   {
-                      case ' ':
-                      case '\t': {
-                           state_idx = (state_trans[state_idx]->Ewhitespace(trans)); // check space
-                           break;
-                        }
-  
-                      case ',':  {
-                           // fast-path will enable here, else, fall through to default
-                           if (FAST_commas_no_quotes_no_comments) {
-                              state_idx = (state_trans[state_idx]->Esep(trans));
-                              break;
-                           }
-                        }
-
-                      default: {
-                           state_idx = (state_trans[state_idx]->Echar(trans));
-                           break;
-                        }
-                   }
-               }
-           }
-     }
+// Column projection: only the given columns (counting from 0) are collected,
+// the rest are scanned past without being copied, and handed to the builder as NULL cells
+// so rows keep their shape.  An empty list collects every column again.
+// Takes effect from the next row, so it can be called from the builder (eg after the header).
+void set_projection( std::vector<size_t> const& columns )
+{
+   std::vector<char> wanted;
+   for (size_t i = 0; i != columns.size(); ++i)
+   {
+      if (columns[i] >= wanted.size())
+         wanted.resize(columns[i]+1, 0);
+      wanted[columns[i]] = 1;
+   }
+   trans.set_projection(wanted);
+}
 
-    if (trans.error_message) {
-#if CPPCSV_DEBUG
-       fprintf(stderr, "State index: %d\n", state.which());
-       fprintf(stderr,"csv parse error: %s\n",error());
+
+// Memory limits for untrusted input: a cell or row longer than this many bytes
+// (after unquoting, skipped columns don't count) is a parse error
+// ("cell too long" / "row too long") instead of growing the buffers without end.
+// 0 means no limit, the default.
+void set_limits( size_t max_cell_bytes, size_t max_row_bytes )
+{
+   trans.set_limits(max_cell_bytes, max_row_bytes);
+}
+
+// One huge row grows the buffers, and they are kept for the rows after it.
+// When they are bigger than keep_bytes, and then after_rows rows in a row fit in keep_bytes,
+// they are freed back to their starting size.
+// Defaults are 1MB and 100 rows.
+// per_batch_tag builders are handed the buffers instead, and can swap them for smaller ones.
+void set_shrink_policy( size_t keep_bytes, size_t after_rows )
+{
+   trans.set_shrink_policy(keep_bytes, after_rows);
+}
+
+// per_batch_tag builders: a batch is handed over when it has max_rows rows,
+// or max_bytes of cells, and at the end of every process_chunk() call.
+// 0 is no limit on that one (both 0: one batch per chunk).
+// Defaults are 4096 rows and 1MB.
+void set_batch_size( size_t max_rows, size_t max_bytes )
+{
+   trans.set_batch_size(max_rows, max_bytes);
+}
+
+// bytes currently held by the parser's buffers
+size_t buffer_capacity() const
+{
+   return trans.buffer_capacity();
+}
+
+// What the parser has seen since it was constructed (or reset()), see csvstats.hpp.
+// All 0 unless compiled with CPPCSV_STATS.
+csv_stats stats() const
+{
+#ifdef CPPCSV_STATS
+   using namespace csvFSM;
+   csv_stats s = trans.stats;
+   s.enabled = true;
+   // a quote opens a cell only before anything else in it
+   s.quoted_cells = transitions[Start][EvQchar] + transitions[ReadSkipPre][EvQchar];
+   // a comment char starts a comment everywhere but in a quoted cell (or a comment, or after a CR)
+   s.comment_lines = transitions[Start][EvComment] + transitions[ReadSkipPre][EvComment] +
+      transitions[ReadQuotedCheckEscape][EvComment] + transitions[ReadQuotedSkipPost][EvComment] +
+      transitions[ReadUnquoted][EvComment] + transitions[ReadUnquotedWhitespace][EvComment];
+   s.escaped_quotes = transitions[ReadQuotedCheckEscape][EvQchar];
+   s.crlf_rows = transitions[ReadDosCR][EvNewline];
+   if (s.sampled_rows)
+      s.builder_ns = static_cast<boost::uint64_t>(static_cast<double>(s.sampled_builder_ns) * s.rows / s.sampled_rows);
+   return s;
+#else
+   return csv_stats();
 #endif
-      return true;
-    }
+}
+
+// Times the builder calls of every n-th row, and all of process_chunk() and flush(),
+// so stats() can tell how the time is split.  0 (the default) turns it off.
+// Does nothing without CPPCSV_STATS.
+void set_stats_sampling( size_t every_n_rows )
+{
+#ifdef CPPCSV_STATS
+   trans.sample_every = every_n_rows;
+   trans.sample_countdown = every_n_rows;
+#else
+   (void)every_n_rows;
+#endif
+}
+
+
+
+bool process_chunk(const std::string &line) // not required to be linewise
+{
+  const char *buf=line.c_str();
+  return process_chunk(buf,line.size());
+}
+
+
+
+// note: call this like so
+// const char* temp = bufptr;
+// process_chunk(temp,len);
+// if there is an error, then temp is at the character that caused the problem.
+bool process_chunk(const char *&buf, const size_t len)
+{
+  char const * const buf_end = buf + len;
+  CPPCSV_STAT(stats_timer timer(trans.sample_every ? &trans.stats.parse_ns : NULL); trans.stats.bytes += len;)
+
+  trans.start_chunk();
+  if (!token_carry.empty() && finish_token_carry(buf, buf_end, false)) {
+     trans.end_batch();
+     return true;
   }
-  return false;
+
+  bool failed = run_bytes(buf, buf_end, buf_end, false);
+  trans.end_chunk();
+  if (trans.error_message && !failed)
+     failed = enter_error();   // keeping the row can be over a limit
+  if (!failed)
+     input_offset += len;
+  return failed;
 }
 
 
@@ -791,12 +1779,22 @@ bool process(const char *&buf, const size_t len)
 // this will help when the input data did not finish with a newline
 bool flush()
 {
+  CPPCSV_STAT(stats_timer timer(trans.sample_every ? &trans.stats.parse_ns : NULL);)
+  if (!token_carry.empty()) {
+    // not a separator after all
+    const char* none = NULL;
+    if (finish_token_carry(none, none, true)) {
+      trans.end_batch();
+      return true;
+    }
+  }
   if (trans.is_row_open()) {
     using namespace csvFSM;
     trans.row_file_start_row = current_row;
-    state_idx = (state_trans[state_idx]-> Enewline(trans) );
+    fire(EvNewline);
   }
-  return (trans.error_message != NULL);
+  trans.end_batch();
+  return trans.error_message && enter_error();
 }
 
 
@@ -811,21 +1809,201 @@ bool flush()
   }
 
 private:
-   void init_states()
+   // Runs the bytes [buf,stop) through the FSM, a separator token can look as far as end.
+   // buf is left after the last byte used (can be past stop, at the end of a token).
+   // NOTE: returns true on error, with buf at the character that caused the problem
+   bool run_bytes( const char *& cursor, const char * const stop, const char * const end, bool last )
    {
-      state_trans[csvFSM::Start] = new csvFSM::ST_Start<MyTrans>();
-      state_trans[csvFSM::ReadSkipPre] = new csvFSM::ST_ReadSkipPre<MyTrans>();
-      state_trans[csvFSM::ReadQuoted] = new csvFSM::ST_ReadQuoted<MyTrans>();
-      state_trans[csvFSM::ReadQuotedCheckEscape] = new csvFSM::ST_ReadQuotedCheckEscape<MyTrans>();
-      state_trans[csvFSM::ReadQuotedSkipPost] = new csvFSM::ST_ReadQuotedSkipPost<MyTrans>();
-      state_trans[csvFSM::ReadDosCR] = new csvFSM::ST_ReadDosCR<MyTrans>();
-      state_trans[csvFSM::ReadQuotedDosCR] = new csvFSM::ST_ReadQuotedDosCR<MyTrans>();
-      state_trans[csvFSM::ReadUnquoted] = new csvFSM::ST_ReadUnquoted<MyTrans>();
-      state_trans[csvFSM::ReadUnquotedWhitespace] = new csvFSM::ST_ReadUnquotedWhitespace<MyTrans>();
-      state_trans[csvFSM::ReadComment] = new csvFSM::ST_ReadComment<MyTrans>();
-      state_trans[csvFSM::ReadError] = new csvFSM::ST_ReadError<MyTrans>();
+     // a local copy, so the compiler can keep it in a register
+     const char* buf = cursor;
+
+     // where the current row starts in this chunk, the column and error context
+     // are only brought up to date when the chunk ends, see catch_up()
+     const char* row_begin = buf;
+
+     for ( ; buf < stop; ++buf ) {
+        // note: current character is written directly to trans,
+        // so that events become empty structs.
+        trans.value = *buf;
+        trans.cursor = buf;
+
+        using namespace csvFSM;
+
+        // one lookup classifies the byte, see init_char_classes()
+        const unsigned char cls = char_class[static_cast<unsigned char>(*buf)];
+
+        switch (cls)
+        {
+           case EvChar:       fire(EvChar); break;
+           case EvWhitespace: fire(EvWhitespace); break;
+           case EvQchar:      fire(EvQchar); break;
+           case EvSep:        fire(EvSep); break;
+           case EvDosCR:      fire(EvDosCR); break;
+           case EvComment:    fire(EvComment); break;
+
+           case EvNewline: {
+                   trans.row_file_start_row = current_row;
+                   fire(EvNewline);
+                   if (collect_error_context)
+                      current_row_content.clear();
+                   ++current_row;
+                   current_column = 0;
+                   row_begin = buf+1;
+                   break;
+                }
 
+           case ClassNull: {
+                   trans.error_message = "Unexpected NULL character"; // check for NULL character
+                   break;
+                }
+
+           case ClassQcharActive: {
+                   // one of several quote chars: once a quoted cell is open,
+                   // only its own quote char is a quote
+                   if (trans.active_qchar == 0 || trans.active_qchar == trans.value)
+                      fire(EvQchar);
+                   else if (char_class_noquote[static_cast<unsigned char>(*buf)] == ClassComment)
+                      fire_comment_gated();
+                   else
+                      fire(static_cast<EventIdx>(char_class_noquote[static_cast<unsigned char>(*buf)]));
+                   break;
+                }
+
+           case ClassComment: {
+                   fire_comment_gated();
+                   break;
+                }
+
+           case ClassSepToken: {
+                   if (!my_is_same<Separators, Separator_Token>::value)
+                      break;   // never happens, and keeps this out of the other parsers
+
+                   // the token is just text inside quotes and comments
+                   const size_t n = (state_idx == ReadQuoted || state_idx == ReadComment) ? 0 : match_token(buf, end, last);
+                   if (n == size_t(-1)) {
+                      // can't tell yet, see finish_token_carry()
+                      catch_up(row_begin, buf);
+                      token_carry.assign(buf, end);
+                      cursor = end;
+                      return false;
+                   }
+                   if (n != 0) {
+                      fire(EvSep);
+                      buf += n-1;
+                   }
+                   else if (token_first_class == ClassComment)
+                      fire_comment_gated();
+                   else
+                      fire(static_cast<EventIdx>(token_first_class));
+                   break;
+                }
+        }
+
+       if (trans.error_message) {
+#if CPPCSV_DEBUG
+          fprintf(stderr, "State index: %d\n", state.which());
+          fprintf(stderr,"csv parse error: %s\n",error());
+#endif
+         catch_up(row_begin, buf+1);   // up to and including the bad char
+         cursor = buf;
+         return enter_error();
+       }
+
+       // inside a cell, skip ahead to the next byte that could do anything
+       // other than add itself to the cell
+       if (state_idx == csvFSM::ReadUnquoted || state_idx == csvFSM::ReadQuoted)
+       {
+          const char * const run = buf + 1;
+          const char * const run_end = find_run_end(run, stop, state_idx == csvFSM::ReadQuoted);
+          if (run_end != run)
+          {
+             const size_t n = run_end - run;
+             if (state_idx == csvFSM::ReadUnquoted)
+                trans.add_whitespace();   // as the Echar transition would
+             trans.add_run(run, n);
+             buf = run_end - 1;
+             if (CPPCSV_UNLIKELY(trans.error_message != NULL)) {
+                // over a limit, somewhere in the run
+                catch_up(row_begin, run_end);
+                cursor = buf;
+                return enter_error();
+             }
+          }
+       }
+     }
+     catch_up(row_begin, buf);
+     cursor = buf;
+     return false;
+   }
+
+   // Trans can fail outside the FSM (a NULL char, over a limit), with the row still open,
+   // so the FSM is moved to ReadError too: it stays there until reset(), as for its own errors.
+   // returns true, for the callers' NOTE: returns true on error
+   bool enter_error()
+   {
+      state_idx = csvFSM::ReadError;
+      return true;
+   }
+
+   // The last chunk ended part way into what could be a separator token,
+   // runs those bytes again with enough of [buf,buf_end) to tell, and moves buf past the ones used.
+   // last: there is no more input, so it is not a token.
+   // NOTE: returns true on error
+   bool finish_token_carry( const char *& buf, const char * const buf_end, bool last )
+   {
+      std::string joined;
+      joined.swap(token_carry);
+      const size_t carried = joined.size();
+      if (buf != buf_end)
+         joined.append(buf, std::min<size_t>(buf_end - buf, token_len - 1));
+
+      const char* p = joined.data();
+      const bool failed = run_bytes(p, p + carried, p + joined.size(), last);
+      trans.end_chunk();   // joined is going away
+
+      // on error in the carried bytes, point at the start of this chunk
+      const size_t used = p - joined.data();
+      if (used > carried)
+         buf += used - carried;
+      return failed;
+   }
+
+   // buf is at the first char of the separator token, returns the token length if it is all there,
+   // 0 if it is not the token, or -1 if end comes first (and it is not the last of the input)
+   size_t match_token( const char* buf, const char* end, bool last ) const
+   {
+      const size_t n = std::min<size_t>(end - buf, token_len);
+      if (memcmp(buf, token, n) != 0)
+         return 0;
+      if (n == token_len)
+         return token_len;
+      return last ? 0 : size_t(-1);
+   }
+
+   void init_states()
+   {
+      // nothing to allocate, the states are shared, see csvFSM::States
       state_idx = csvFSM::Start;
+      CPPCSV_STAT(memset(transitions, 0, sizeof(transitions));)
+   }
+
+   // sends one event to the FSM, trans.value must already be set
+   void fire( csvFSM::EventIdx ev )
+   {
+      CPPCSV_STAT(++transitions[state_idx][ev];)
+      using namespace csvFSM;
+      ST_Base<MyTrans> const& st = *States<MyTrans>::all[state_idx];
+      switch (ev)
+      {
+         case EvChar:       state_idx = st.Echar(trans); break;
+         case EvWhitespace: state_idx = st.Ewhitespace(trans); break;
+         case EvQchar:      state_idx = st.Eqchar(trans); break;
+         case EvSep:        state_idx = st.Esep(trans); break;
+         case EvNewline:    state_idx = st.Enewline(trans); break;
+         case EvDosCR:      state_idx = st.Edos_cr(trans); break;
+         case EvComment:    state_idx = st.Ecomment(trans); break;
+         case NUM_EV:       assert(0); break;
+      }
    }
 
   QuoteChars qchar;  // could be char or string
@@ -836,53 +2014,224 @@ private:
   const char *errmsg;
 
   bool collect_error_context;
+  boost::uint64_t input_offset;     // bytes given to process_chunk(), for csv_checkpoint
   std::string current_row_content;  // remember what we read for error printouts
 
   csvFSM::StateIdx state_idx;
-  csvFSM::ST_Base<MyTrans> * state_trans[csvFSM::NUM_SI];
   MyTrans trans;
+#ifdef CPPCSV_STATS
+  boost::uint64_t transitions[csvFSM::NUM_SI][csvFSM::NUM_EV];   // times each was taken, for stats()
+#endif
+
+  // byte -> csvFSM::EventIdx or csvFSM::CharClass, built once by init_char_classes()
+  unsigned char char_class[256];
+  // same, as if there were no quote chars (for ClassQcharActive)
+  unsigned char char_class_noquote[256];
+
+  // bytes that end a run of plain cell content, see process_chunk()
+  scan::byte_set unquoted_stops;
+  scan::byte_set quoted_stops;
+
+  // Separator_Token, when it is more than one char
+  const char* token;
+  size_t token_len;
+  unsigned char token_first_class;   // of the first char, when it is not the whole token
+  std::string token_carry;           // the start of what could be one, at the end of the last chunk
+
+  // Runs the quote/separator/comment/whitespace tests for every possible byte,
+  // so process_chunk() only does one lookup per byte.
+  // The order of the tests decides which wins, eg if a char is both a quote and a separator.
+  void init_char_classes()
+  {
+     const std::string* t = token_of(sep);
+     token = t ? t->data() : NULL;
+     token_len = t ? t->size() : 1;
+     token_first_class = token_len > 1 ? classify(token[0], true, false) : csvFSM::EvChar;
+     assert(token_first_class != csvFSM::EvSep && token_first_class != csvFSM::EvQchar && token_first_class != csvFSM::ClassQcharActive);
+
+     for (int i = 0; i != 256; ++i)
+     {
+        char_class[i] = classify(static_cast<char>(i), true, true);
+        char_class_noquote[i] = classify(static_cast<char>(i), false, false);
+     }
+
+     // ReadUnquoted adds chars and (tolerated) quotes,
+     // ReadQuoted adds everything except quotes, CRs, nulls, and
+     // newlines (which are counted in process_chunk()).
+     unquoted_stops.clear();
+     quoted_stops.clear();
+     for (int i = 0; i != 256; ++i)
+     {
+        const unsigned char cls = char_class[i];
+        if (cls != csvFSM::EvChar && cls != csvFSM::EvQchar)
+           unquoted_stops.insert(static_cast<char>(i));
+        if (cls == csvFSM::EvQchar || cls == csvFSM::ClassQcharActive || cls == csvFSM::ClassComment ||
+            cls == csvFSM::EvDosCR || cls == csvFSM::EvNewline || cls == csvFSM::ClassNull)
+           quoted_stops.insert(static_cast<char>(i));
+     }
+  }
+
+  // the next byte in [run,end) that could do anything other than add itself to the cell
+  const char* find_run_end( const char* run, const char* end, bool quoted ) const
+  {
+     if (static_dialect)
+     {
+        // a superset of the stops below, any extra ones just go through the FSM
+        const char q = static_char<QuoteChars>::value;
+        const char s = static_char<Separators>::value;
+        const char c = static_char<CommentChars>::value;
+        if (quoted)
+           return scan::static_byte_set<q, '\r', '\n', c, '\0', q, q, q>::find(run, end);
+        return scan::static_byte_set<s, ' ', '\t', '\r', '\n', c, '\0', s>::find(run, end);
+     }
+     return (quoted ? quoted_stops : unquoted_stops).find(run, end);
+  }
+
+  // with_token: the first char of a Separator_Token is ClassSepToken, otherwise it is not a separator
+  unsigned char classify( char c, bool with_quotes, bool with_token ) const
+  {
+     using namespace csvFSM;
+
+     if (c == '\r')
+        return EvDosCR;
+     if (c == '\n')
+        return EvNewline;
+     if (allow_null_char != DoAllowNullChars && c == '\0')
+        return ClassNull;
+     if (!FAST_commas_no_quotes_no_comments && with_quotes && match_char(qchar, c))
+        return quote_class(qchar);
+     if (!FAST_commas_no_quotes_no_comments && match_char(sep, c))
+     {
+        if (token_len == 1)
+           return EvSep;
+        if (with_token)
+           return ClassSepToken;
+     }
+     if (!FAST_commas_no_quotes_no_comments && match_char(comment, c))
+     {
+        // this one is more complex gate...
+        // only emit a comment event if comments can be anywhere or
+        // the row is still empty
+        if (comments_must_be_at_start_of_line)
+           return ClassComment;
+        return EvComment;
+     }
+     if (c == ' ' || c == '\t')
+        return EvWhitespace;
+     if (FAST_commas_no_quotes_no_comments && c == ',')
+        return EvSep;
+     return EvChar;
+  }
+
+  // everything that changes how the bytes are read, so a checkpoint is not
+  // restored into a parser that would read them differently
+  boost::uint64_t dialect_hash() const
+  {
+     boost::uint64_t h = UINT64_C(14695981039346656037);   // FNV-1a
+     std::vector<unsigned char> bytes(256*2 + 3);
+     std::copy(char_class, char_class + 256, bytes.begin());
+     std::copy(char_class_noquote, char_class_noquote + 256, bytes.begin() + 256);
+     bytes[512] = trans.trim_whitespace;
+     bytes[513] = trans.collapse_separators;
+     bytes[514] = trans.builder_kind();
+     if (token_len > 1)
+        bytes.insert(bytes.end(), token, token + token_len);
+     for (size_t i = 0; i != bytes.size(); ++i)
+        h = (h ^ bytes[i]) * UINT64_C(1099511628211);
+     return h;
+  }
+
+  // the bytes [row_begin,end) of the current row have been processed
+  void catch_up( const char* row_begin, const char* end )
+  {
+     current_column += end - row_begin;
+     if (collect_error_context)
+        current_row_content.append(row_begin, end);
+  }
+
+  // a comment char that is only a comment at the start of the row,
+  // otherwise its just whitespace or a char
+  void fire_comment_gated()
+  {
+     using namespace csvFSM;
+     if (trans.row_empty())
+        fire(EvComment);
+     else if (trans.value == ' ' || trans.value == '\t')
+        fire(EvWhitespace);
+     else
+        fire(EvChar);
+  }
 
   // support either single or multiple quote characters
-  bool is_quote_char( char the_qchar ) const
+  // single: always a quote,
+  // multiple: only the active quote char counts once a quoted cell has started
+  unsigned char quote_class( char ) const
   {
-    return match_char(the_qchar);
+    return csvFSM::EvQchar;
   }
 
-  bool is_quote_char( Disable ) const
+  template <char C>
+  unsigned char quote_class( Quote<C> ) const
   {
-    return false;
+    return csvFSM::EvQchar;
   }
 
   template <class Container>
-  bool is_quote_char( Container const& the_qchar ) const
+  unsigned char quote_class( Container const& ) const
   {
-    if (trans.active_qchar != 0)
-       return match_char(trans.active_qchar);
-    return match_char(the_qchar);
+    return csvFSM::ClassQcharActive;
   }
 
   // support either a single char or a string of chars
 
   // note: ignores the null (0) character (ie if there is no comment char)
-  bool match_char( Disable ) const {
+  static bool match_char( Disable, char ) {
      return false;
   }
 
-  bool match_char( Separator_Comma ) const {
-     assert(0);   // should not actually be called, should be picked up by switch first
-     return trans.value == ',';
+  // only used if not all of the fast-path types are set
+  static bool match_char( Separator_Comma, char c ) {
+     return c == ',';
+  }
+
+  template <char C>
+  static bool match_char( Sep<C>, char c ) {
+     return C != 0 && C == c;
+  }
+
+  template <char C>
+  static bool match_char( Quote<C>, char c ) {
+     return C != 0 && C == c;
+  }
+
+  template <char C>
+  static bool match_char( Comment<C>, char c ) {
+     return C != 0 && C == c;
+  }
+
+  static bool match_char( Separator_Token const& target, char c ) {
+     return !target.token.empty() && target.token[0] == c;
+  }
+
+  static const std::string* token_of( Separator_Token const& t ) {
+     return &t.token;
+  }
+
+  template <class T>
+  static const std::string* token_of( T const& ) {
+     return NULL;
   }
 
-  bool match_char( char target ) const {
-     return target != 0 && target == trans.value;
+  static bool match_char( char target, char c ) {
+     return target != 0 && target == c;
   }
 
   template <class Container>
-  bool match_char( Container const& target ) const {
+  static bool match_char( Container const& target, char c ) {
      // boost not needed ...
      // using boost::range::find;
-     // return find(target, trans.value) != boost::end(target);
-     return std::find(target.begin(), target.end(), trans.value) != target.end();
+     // return find(target, c) != boost::end(target);
+     return std::find(target.begin(), target.end(), c) != target.end();
   }
 };
 
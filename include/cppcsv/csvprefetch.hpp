@@ -0,0 +1,273 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Reads ahead of the parser on a background thread, so reading and parsing overlap:
+//
+//    cppcsv::file_source file(stdin);
+//    cppcsv::prefetch_source in(file);
+//    if (cppcsv::parse_source(parser, in))
+//       handle error;
+//
+// The thread pulls blocks from the wrapped source into a ring of buffers,
+// while the parser works on the block it was given last.
+// Blocks start at block_size, and double (up to max_block_size) every time
+// the parser has to wait for one, so slow storage (eg a network mount) gets
+// bigger reads, and a fast disk keeps small ones that stay in the CPU cache.
+//
+// Worth it when reads block: pipes, files read with fread(), network mounts.
+// A memory mapped file_source on a local disk is already as fast as it gets.
+//
+// Errors thrown by the wrapped source on the thread are thrown again from next(),
+// as std::runtime_error.
+
+#include "csvsource.hpp"
+
+#include <boost/bind/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cppcsv {
+
+
+class prefetch_source : public input_source {
+   // noncopyable
+   prefetch_source( prefetch_source const& );
+   prefetch_source& operator=( prefetch_source const& );
+
+public:
+   static const size_t default_block_size = 256*1024;
+   static const size_t default_max_block_size = 8*1024*1024;
+
+   // in must outlive this, and not be used by anything else until this is gone.
+   // num_buffers: at least 2, one for the parser and the rest read ahead
+   explicit prefetch_source( input_source & in, size_t num_buffers = 3,
+         size_t block_size = default_block_size, size_t max_block_size = default_max_block_size ) :
+      in(in),
+      buffers(std::max<size_t>(num_buffers, 2)),
+      lens(buffers.size(), 0),
+      read_idx(0),
+      write_idx(0),
+      filled(0),
+      handed_out(false),
+      at_end(false),
+      stopping(false),
+      first_block(true),
+      cur_block_size(std::max<size_t>(block_size, 1)),
+      max_block_size(std::max(block_size, max_block_size)),
+      pos(0),
+      raw_pos(in.raw_position()),
+      num_waits(0),
+      pending(NULL),
+      pending_len(0)
+   {
+      start();
+   }
+
+   ~prefetch_source()
+   {
+      stop();
+   }
+
+   boost::uint64_t position() const { return pos; }
+   boost::uint64_t size() const { return in.size(); }
+
+   // as far as the reader has got, it is ahead of position()
+   boost::uint64_t raw_position() const
+   {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      return raw_pos;
+   }
+
+   size_t next( const char*& data )
+   {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      if (handed_out)
+      {
+         // the parser is done with the last one
+         handed_out = false;
+         read_idx = (read_idx + 1) % buffers.size();
+         --filled;
+         changed.notify_all();
+      }
+
+      if (filled == 0 && !at_end)
+      {
+         if (!first_block)
+         {
+            // reading is slower than parsing
+            ++num_waits;
+            cur_block_size = std::min(cur_block_size*2, max_block_size);
+         }
+         while (filled == 0 && !at_end)
+            changed.wait(lock);
+      }
+
+      if (filled == 0)
+      {
+         if (!error.empty())
+            throw std::runtime_error(error);
+         return 0;
+      }
+
+      handed_out = true;
+      first_block = false;
+      data = &buffers[read_idx][0];
+      pos += lens[read_idx];
+      return lens[read_idx];
+   }
+
+   // throws away what was read ahead, and carries on from offset in the wrapped source
+   bool seek( boost::uint64_t offset )
+   {
+      stop();
+      read_idx = write_idx = filled = 0;
+      handed_out = at_end = false;
+      pending = NULL;
+      pending_len = 0;
+      error.clear();
+      const bool ok = in.seek(offset);
+      if (ok)
+         pos = offset;
+      raw_pos = in.raw_position();
+      start();
+      return ok;
+   }
+
+   // how much is read at once now
+   size_t block_size() const
+   {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      return cur_block_size;
+   }
+
+   // times next() had to wait for the reader
+   size_t waits() const
+   {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      return num_waits;
+   }
+
+private:
+   input_source & in;
+   std::vector<std::vector<char> > buffers;
+   std::vector<size_t> lens;
+   size_t read_idx;      // the next one for the parser
+   size_t write_idx;     // the next one for the reader
+   size_t filled;        // read, and not yet given back by the parser
+   bool handed_out;      // buffers[read_idx] is the parser's
+   bool at_end;          // the reader has stopped (end of input, or error)
+   bool stopping;
+   bool first_block;     // the parser always waits for that one
+   size_t cur_block_size;
+   size_t max_block_size;
+   boost::uint64_t pos;
+   boost::uint64_t raw_pos;
+   size_t num_waits;
+   std::string error;
+
+   // reader thread only: what is left of the wrapped source's last block
+   const char* pending;
+   size_t pending_len;
+
+   mutable boost::mutex mutex;
+   boost::condition_variable changed;
+   boost::thread reader;
+
+   void start()
+   {
+      stopping = false;
+      first_block = true;
+      reader = boost::thread(boost::bind(&prefetch_source::read_loop, this));
+   }
+
+   void stop()
+   {
+      {
+         boost::lock_guard<boost::mutex> lock(mutex);
+         stopping = true;
+      }
+      changed.notify_all();
+      reader.join();
+   }
+
+   void read_loop()
+   {
+      while (true)
+      {
+         size_t idx, want;
+         {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (filled == buffers.size() && !stopping)
+               changed.wait(lock);
+            if (stopping)
+               return;
+            idx = write_idx;
+            want = cur_block_size;
+         }
+
+         std::vector<char> & buf = buffers[idx];   // not the parser's, filled < size
+         if (buf.size() < want)
+            buf.resize(want);
+
+         std::string what;
+         const size_t got = fill(&buf[0], want, what);
+         const boost::uint64_t raw = in.raw_position();
+
+         boost::lock_guard<boost::mutex> lock(mutex);
+         raw_pos = raw;
+         if (got != 0)
+         {
+            lens[idx] = got;
+            write_idx = (write_idx + 1) % buffers.size();
+            ++filled;
+         }
+         if (got < want || !what.empty())
+         {
+            at_end = true;
+            error = what;
+         }
+         changed.notify_all();
+         if (at_end)
+            return;
+      }
+   }
+
+   // copies up to n bytes from the wrapped source, less only at the end (or on an error, in what)
+   size_t fill( char* out, size_t n, std::string & what )
+   {
+      size_t got = 0;
+      while (got != n)
+      {
+         if (pending_len == 0)
+         {
+            try {
+               pending_len = in.next(pending);
+            }
+            catch (std::exception const& e) {
+               what = e.what();
+               break;
+            }
+            if (pending_len == 0)
+               break;
+         }
+         const size_t take = std::min(n - got, pending_len);
+         memcpy(out + got, pending, take);
+         got += take;
+         pending += take;
+         pending_len -= take;
+      }
+      return got;
+   }
+};
+
+
+} // namespace cppcsv
@@ -0,0 +1,205 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Pull style reading, for when a builder's callbacks are awkward,
+// eg to read several files side by side (a merge-join) without threads:
+//
+//    cppcsv::file_source in("input.csv");
+//    cppcsv::csv_reader<> reader(in, cppcsv::csv_dialect<char,char,char>('"', ','));
+//    cppcsv::row_view row;
+//    while (reader.next_row(row))
+//       for (size_t i = 0; i != row.size(); ++i)
+//          use(row[i].data, row[i].len);   // data is NULL for a null cell
+//    if (reader.error())
+//       printf("error: %s\n", reader.error());
+//
+// The reader parses a slice of the source's block (64KB by default, with
+// zero-copy on) only when it has handed out all the rows from the last slice,
+// so memory stays bounded even when the block is a whole memory mapped file,
+// and the next block is only taken once this one is used up.
+// Most cells point straight into the source's block. Cells that had to be
+// put together by the parser (eg "a""b", or a cell that crosses two slices)
+// are copied once into the reader.
+//
+// A row_view is valid until the next call to next_row().
+
+#include "csvparser.hpp"
+#include "csvsource.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace cppcsv {
+
+
+// one row from csv_reader::next_row()
+struct row_view {
+   const cell_span* cells;    // array[num_cells]
+   size_t num_cells;
+   size_t file_row;           // row where these cells started
+
+   row_view() : cells(NULL), num_cells(0), file_row(0) {}
+
+   size_t size() const { return num_cells; }
+   cell_span const& operator[]( size_t i ) const { return cells[i]; }
+};
+
+
+
+template <class QuoteChars = char, class Separators = char, class CommentChars = char>
+class csv_reader
+{
+   // disable copy
+   csv_reader& operator=(csv_reader const&);
+   csv_reader(csv_reader const&);
+
+public:
+   typedef csv_dialect<QuoteChars,Separators,CommentChars> Dialect;
+
+   static const size_t default_slice_bytes = 64*1024;
+
+   // slice_bytes: how much of the source's block is parsed at once, 0 for all of it
+   csv_reader( input_source & source, Dialect const& dialect, size_t slice_bytes = default_slice_bytes ) :
+      source(source),
+      parser(rows, dialect),
+      next(0),
+      done(false),
+      slice_bytes(slice_bytes),
+      pending(NULL),
+      pending_len(0)
+   {
+      parser.set_zero_copy(true);
+   }
+
+   // returns false at the end of the input, or on error (see error())
+   bool next_row( row_view & row )
+   {
+      while (next == rows.rows.size())
+      {
+         if (done)
+            return false;
+         refill();
+      }
+
+      typename row_store::row const& r = rows.rows[next++];
+      row.cells = &rows.cells[r.cells_begin];
+      row.num_cells = r.num_cells;
+      row.file_row = r.file_row;
+      return true;
+   }
+
+   // see csv_parser::set_projection(), takes effect from the next slice
+   void set_projection( std::vector<size_t> const& columns ) { parser.set_projection(columns); }
+
+   // note: returns NULL if no error
+   const char * error() const { return parser.error(); }
+   std::string error_context() const { return parser.error_context(); }
+
+   size_t get_current_row() const { return parser.get_current_row(); }
+   size_t get_current_column() const { return parser.get_current_column(); }
+
+private:
+   // keeps the rows from one block
+   class row_store : public per_row_span_tag {
+   public:
+      struct row {
+         size_t cells_begin;
+         size_t num_cells;
+         size_t file_row;
+      };
+
+      std::vector<cell_span> cells;
+      std::vector<row> rows;
+
+      // cells that are not in the block, see fix_copies()
+      std::vector<char> copies;
+      std::vector<size_t> copied_cells;
+      std::vector<size_t> copied_offsets;
+
+      const char* block_begin;
+      const char* block_end;
+
+      row_store() : block_begin(NULL), block_end(NULL) {}
+
+      void clear()
+      {
+         cells.clear();
+         rows.clear();
+         copies.clear();
+         copied_cells.clear();
+         copied_offsets.clear();
+      }
+
+      void end_full_row( const cell_span* row_cells, size_t num_cells, size_t file_row )
+      {
+         row r = { cells.size(), num_cells, file_row };
+         for (size_t i = 0; i != num_cells; ++i)
+         {
+            cell_span c = row_cells[i];
+            if (c.data != NULL && !(c.data >= block_begin && c.data + c.len <= block_end))
+            {
+               // in the parser's buffer, which is reused for the next row
+               copied_cells.push_back(cells.size());
+               copied_offsets.push_back(copies.size());
+               copies.insert(copies.end(), c.data, c.data + c.len);
+            }
+            cells.push_back(c);
+         }
+         rows.push_back(r);
+      }
+
+      // copies can move while the block is parsed, so point at them after
+      void fix_copies()
+      {
+         const char* base = copies.empty() ? "" : &copies[0];
+         for (size_t i = 0; i != copied_cells.size(); ++i)
+            cells[copied_cells[i]].data = base + copied_offsets[i];
+      }
+   };
+
+   input_source & source;
+   row_store rows;      // before parser, which keeps a reference to it
+   csv_parser<row_store,QuoteChars,Separators,CommentChars> parser;
+   size_t next;         // next row to hand out
+   bool done;
+   const size_t slice_bytes;
+
+   // what is left of the source's block
+   const char* pending;
+   size_t pending_len;
+
+   void refill()
+   {
+      rows.clear();
+      next = 0;
+
+      if (pending_len == 0)
+      {
+         pending_len = source.next(pending);
+         rows.block_begin = pending;
+         rows.block_end = pending + pending_len;
+      }
+      if (pending_len == 0)
+      {
+         rows.block_begin = rows.block_end = NULL;
+         parser.flush();
+         done = true;
+      }
+      else
+      {
+         const size_t n = (slice_bytes != 0) ? std::min(slice_bytes, pending_len) : pending_len;
+         const char* slice = pending;
+         pending += n;
+         pending_len -= n;
+         // rows before an error are still handed out
+         if (parser.process_chunk(slice, n))
+            done = true;
+      }
+
+      rows.fix_copies();
+   }
+};
+
+
+} // namespace cppcsv
@@ -0,0 +1,202 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Finds the next "interesting" byte in a block of input,
+// so csv_parser can skip over runs of plain cell content.
+//
+// Uses AVX2 if the CPU has it (checked once at runtime, GCC/Clang only),
+// else SSE2 (always there on x86-64), else a plain loop.
+// Define CPPCSV_NO_SIMD to always use the plain loop.
+
+#include <cstddef>
+#include <cstring>
+
+#if !defined(CPPCSV_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  define CPPCSV_SCAN_SSE2 1
+#  include <emmintrin.h>
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#     define CPPCSV_SCAN_AVX2 1
+#     include <immintrin.h>
+#  endif
+#endif
+
+namespace cppcsv {
+namespace scan {
+
+
+// index of the lowest set bit, mask must not be zero
+inline int first_bit( unsigned int mask ) {
+#if defined(__GNUC__)
+   return __builtin_ctz(mask);
+#else
+   int i = 0;
+   while ((mask & 1u) == 0) {
+      mask >>= 1;
+      ++i;
+   }
+   return i;
+#endif
+}
+
+
+// a set of up to max_needles bytes, searched for with SIMD compares,
+// if there are more then the byte table is used instead.
+class byte_set {
+public:
+   static const int max_needles = 8;
+
+   byte_set() : count(0) {
+      memset(member, 0, sizeof(member));
+   }
+
+   void clear() {
+      count = 0;
+      memset(member, 0, sizeof(member));
+   }
+
+   void insert( char c ) {
+      unsigned char uc = static_cast<unsigned char>(c);
+      if (member[uc])
+         return;
+      member[uc] = true;
+      if (count < max_needles)
+         needles[count] = c;
+      ++count;
+   }
+
+   bool contains( char c ) const {
+      return member[static_cast<unsigned char>(c)];
+   }
+
+   // returns the first position in [begin,end) that holds a byte from the set, or end
+   const char* find( const char* begin, const char* end ) const {
+      if (count > max_needles)
+         return find_plain(begin, end);
+      return find_fn()(*this, begin, end);
+   }
+
+   const char* find_plain( const char* begin, const char* end ) const {
+      while (begin != end && !member[static_cast<unsigned char>(*begin)])
+         ++begin;
+      return begin;
+   }
+
+   int size() const { return count; }
+
+   typedef const char* (*find_func)( byte_set const&, const char*, const char* );
+
+   // picks the best version for this CPU, once
+   static find_func find_fn() {
+      static const find_func fn = choose_find_fn();
+      return fn;
+   }
+
+private:
+   int count;
+   char needles[max_needles];
+   bool member[256];
+
+   static find_func choose_find_fn() {
+#if CPPCSV_SCAN_AVX2
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+         return &find_avx2;
+#endif
+#if CPPCSV_SCAN_SSE2
+      return &find_sse2;
+#else
+      return &find_scalar;
+#endif
+   }
+
+   static const char* find_scalar( byte_set const& s, const char* begin, const char* end ) {
+      return s.find_plain(begin, end);
+   }
+
+#if CPPCSV_SCAN_SSE2
+   static const char* find_sse2( byte_set const& s, const char* begin, const char* end ) {
+      if (s.count == 0)
+         return end;   // n[] would not be set
+      __m128i n[max_needles];
+      for (int i = 0; i != s.count; ++i)
+         n[i] = _mm_set1_epi8(s.needles[i]);
+
+      while (end - begin >= 16)
+      {
+         const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+         __m128i hit = _mm_cmpeq_epi8(block, n[0]);
+         for (int i = 1; i < s.count; ++i)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, n[i]));
+         const int mask = _mm_movemask_epi8(hit);
+         if (mask != 0)
+            return begin + first_bit(static_cast<unsigned int>(mask));
+         begin += 16;
+      }
+      return s.find_plain(begin, end);
+   }
+#endif
+
+#if CPPCSV_SCAN_AVX2
+   __attribute__((target("avx2")))
+   static const char* find_avx2( byte_set const& s, const char* begin, const char* end ) {
+      if (s.count == 0)
+         return end;   // n[] would not be set
+      __m256i n[max_needles];
+      for (int i = 0; i != s.count; ++i)
+         n[i] = _mm256_set1_epi8(s.needles[i]);
+
+      while (end - begin >= 32)
+      {
+         const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+         __m256i hit = _mm256_cmpeq_epi8(block, n[0]);
+         for (int i = 1; i < s.count; ++i)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, n[i]));
+         const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(hit));
+         if (mask != 0)
+            return begin + first_bit(mask);
+         begin += 32;
+      }
+      return find_sse2(s, begin, end);
+   }
+#endif
+};
+
+
+// Same as byte_set::find(), for a set known at compile time (repeat a byte to fill the slots).
+// The compares are constants and there is nothing to set up or dispatch per call,
+// which matters more than the vector width for the short runs in most cells,
+// so this is SSE2 only, and inlined.
+template <char C0, char C1, char C2, char C3, char C4, char C5, char C6, char C7>
+struct static_byte_set {
+   static bool contains( char c ) {
+      return c == C0 || c == C1 || c == C2 || c == C3 || c == C4 || c == C5 || c == C6 || c == C7;
+   }
+
+   static const char* find( const char* begin, const char* end ) {
+#if CPPCSV_SCAN_SSE2
+      while (end - begin >= 16)
+      {
+         const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+         const __m128i hit = _mm_or_si128(
+               _mm_or_si128(
+                  _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(C0)), _mm_cmpeq_epi8(block, _mm_set1_epi8(C1))),
+                  _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(C2)), _mm_cmpeq_epi8(block, _mm_set1_epi8(C3)))),
+               _mm_or_si128(
+                  _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(C4)), _mm_cmpeq_epi8(block, _mm_set1_epi8(C5))),
+                  _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(C6)), _mm_cmpeq_epi8(block, _mm_set1_epi8(C7)))));
+         const int mask = _mm_movemask_epi8(hit);
+         if (mask != 0)
+            return begin + first_bit(static_cast<unsigned int>(mask));
+         begin += 16;
+      }
+#endif
+      while (begin != end && !contains(*begin))
+         ++begin;
+      return begin;
+   }
+};
+
+
+} // namespace scan
+} // namespace cppcsv
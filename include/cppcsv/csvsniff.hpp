@@ -0,0 +1,334 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Guesses the dialect of a file from its first few hundred KB:
+//
+//    cppcsv::file_source in("unknown.csv");
+//    std::string sample;
+//    cppcsv::sniffed_dialect d;
+//    if (cppcsv::sniff_source(in, sample, d))
+//       handle empty input;
+//    MyBuilder builder;
+//    parse_it f(sample, in);    // operator()(Parser&) parses sample, then parse_source(parser, in)
+//    if (cppcsv::with_sniffed_parser(builder, d, f))
+//       handle error;
+//
+// Every candidate separator (, ; tab | :) is counted on every line of the sample,
+// outside quotes, once for each possible quote char (none, " and ').
+// The separator wins that splits the most lines into the same number of cells,
+// the quote char that opens and properly closes the most cells.
+// Lines starting with # are comments if they don't have the shape of the other lines.
+//
+// confidence is how many of the lines agree on the separator, less a bit if
+// another separator would do nearly as well, so a one column file
+// (or a sample with just one line) comes out low.
+//
+// with_sniffed_parser() then picks the fastest csv_parser for the dialect:
+// the quote-free comma parser when there are no quotes and comments,
+// compile-time dialects for the common cases, and the runtime char one otherwise.
+
+#include "csvparser.hpp"
+#include "csvsource.hpp"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace cppcsv {
+
+
+struct sniffed_dialect {
+   char sep;
+   char qchar;                 // 0 if no cell in the sample is quoted
+   char comment;               // 0 if there are no comment lines
+   bool crlf;                  // most lines end with \r\n (the parser takes either)
+   bool trim_whitespace;       // most separators are followed by a space
+   size_t columns;             // cells in most rows
+   size_t rows;                // complete rows in the sample, comments not counted
+   double confidence;          // of sep and columns, 0 to 1
+   double quote_confidence;    // of qchar: the share of its quotes that were where they should be
+
+   sniffed_dialect() :
+      sep(','), qchar('"'), comment(0), crlf(false), trim_whitespace(false),
+      columns(0), rows(0), confidence(0), quote_confidence(0)
+   {
+   }
+
+   csv_dialect<char,char,char> dialect() const
+   {
+      return csv_dialect<char,char,char>(qchar, sep, trim_whitespace, false, comment, true);
+   }
+};
+
+
+namespace sniff_detail {
+
+   static const char candidate_seps[] = { ',', '\t', ';', '|', ':' };
+   enum { NUM_SEPS = sizeof(candidate_seps) };
+   enum { NUM_LIKELY_SEPS = 4 };   // : only wins outright, it is in too many times of day
+
+   inline int sep_index( char c )
+   {
+      for (int i = 0; i != NUM_SEPS; ++i)
+         if (candidate_seps[i] == c)
+            return i;
+      return -1;
+   }
+
+   // one pass over the sample with one quote char
+   struct quote_pass {
+      char qchar;
+      size_t data_lines;
+      size_t crlf_lines;
+      size_t quoted_cells;      // opened at the start of a cell, closed before a separator or newline
+      size_t bad_quotes;        // in the middle of a cell, or followed by something else
+      size_t spaces_after[NUM_SEPS];
+      size_t seps[NUM_SEPS];
+      std::map<size_t,size_t> lines_with[NUM_SEPS];     // separator count -> lines
+      std::vector<std::vector<size_t> > hash_lines;     // separator counts of lines starting with #
+
+      explicit quote_pass( char qchar ) :
+         qchar(qchar), data_lines(0), crlf_lines(0), quoted_cells(0), bad_quotes(0)
+      {
+         std::fill(spaces_after, spaces_after + NUM_SEPS, 0);
+         std::fill(seps, seps + NUM_SEPS, 0);
+      }
+
+      // at_end: end is the end of the input, so the last line is complete even without a newline
+      void run( const char* const begin, const char* const end, bool at_end )
+      {
+         signed char sep_of[256];
+         for (int c = 0; c != 256; ++c)
+            sep_of[c] = static_cast<signed char>(sep_index(static_cast<char>(c)));
+
+         size_t counts[NUM_SEPS] = {};
+         bool cell_start = true;    // only spaces since the last separator or newline
+         bool line_start = true;
+         bool hash_line = false;
+         bool in_quotes = false;
+         for (const char* p = begin; p != end; ++p)
+         {
+            const char c = *p;
+            if (in_quotes) {
+               if (c != qchar)
+                  continue;
+               if (p+1 != end && p[1] == qchar) {
+                  ++p;   // escaped
+                  continue;
+               }
+               in_quotes = false;
+               const char n = (p+1 == end) ? '\n' : p[1];
+               if (n == '\n' || n == '\r' || n == ' ' || sep_of[static_cast<unsigned char>(n)] >= 0)
+                  ++quoted_cells;
+               else
+                  ++bad_quotes;
+               cell_start = false;
+               continue;
+            }
+
+            const int s = sep_of[static_cast<unsigned char>(c)];
+            if (c == '\n') {
+               if (p != begin && p[-1] == '\r')
+                  ++crlf_lines;
+               end_line(counts, hash_line);
+               cell_start = line_start = true;
+               hash_line = false;
+            }
+            else if (s >= 0) {
+               ++counts[s];
+               if (p+1 != end && p[1] == ' ')
+                  ++spaces_after[s];
+               cell_start = true;
+               line_start = false;
+            }
+            else if (c == ' ' || c == '\r') {
+               // a quote can still open the cell
+            }
+            else {
+               if (line_start && c == '#')
+                  hash_line = true;
+               else if (qchar && c == qchar && !hash_line) {
+                  if (cell_start)
+                     in_quotes = true;
+                  else
+                     ++bad_quotes;
+               }
+               cell_start = line_start = false;
+            }
+         }
+         // an unfinished line at the end of the sample is not counted
+         if (at_end && !in_quotes && end != begin && end[-1] != '\n')
+            end_line(counts, hash_line);
+      }
+
+      void end_line( size_t* counts, bool hash_line )
+      {
+         if (hash_line)
+            hash_lines.push_back(std::vector<size_t>(counts, counts + NUM_SEPS));
+         else {
+            ++data_lines;
+            for (int s = 0; s != NUM_SEPS; ++s) {
+               ++lines_with[s][counts[s]];
+               seps[s] += counts[s];
+            }
+         }
+         std::fill(counts, counts + NUM_SEPS, 0);
+      }
+
+      // the most common separator count, and how many lines have it
+      std::pair<size_t,size_t> mode( int s ) const
+      {
+         std::pair<size_t,size_t> best(0, 0);
+         for (std::map<size_t,size_t>::const_iterator it = lines_with[s].begin(); it != lines_with[s].end(); ++it)
+            if (it->second > best.second)
+               best = *it;
+         return best;
+      }
+   };
+
+
+   // see sniff_dialect(), at_end: data is all of the input
+   inline bool sniff( const char* data, size_t len, bool at_end, sniffed_dialect & d )
+   {
+      const char* const end = data + len;
+      quote_pass passes[3] = { quote_pass(0), quote_pass('"'), quote_pass('\'') };
+      for (int i = 0; i != 3; ++i)
+         passes[i].run(data, end, at_end);
+
+      // a quote char that was used properly more than not, " on a tie
+      int q = 0;
+      for (int i = 1; i != 3; ++i)
+         if (passes[i].quoted_cells > passes[i].bad_quotes && passes[i].quoted_cells > passes[q].quoted_cells)
+            q = i;
+      quote_pass const& pass = passes[q];
+      if (pass.data_lines == 0 && pass.hash_lines.empty())
+         return true;
+
+      // The separator that puts the most lines in agreement, as long as there is one.
+      // On a tie the one with more cells, since a separator is in every cell boundary,
+      // and a decimal comma or a time of day is only in some of them.
+      int best = -1;
+      double best_share = 0, second_share = 0;
+      size_t best_count = 0;
+      for (int s = 0; s != NUM_SEPS; ++s)
+      {
+         const std::pair<size_t,size_t> m = pass.mode(s);
+         if (m.first == 0)
+            continue;
+         const double share = pass.data_lines ? double(m.second) / pass.data_lines : 0;
+         if (best < 0 || share > best_share
+               || (share == best_share && s < NUM_LIKELY_SEPS && m.first > best_count)) {
+            second_share = best_share;
+            best = s;
+            best_share = share;
+            best_count = m.first;
+         }
+         else if (share > second_share)
+            second_share = share;
+      }
+
+      // # lines are comments when they don't look like the rest
+      size_t comments = 0;
+      for (size_t i = 0; i != pass.hash_lines.size(); ++i)
+         if (best < 0 || pass.hash_lines[i][best] != best_count)
+            ++comments;
+      const bool hash_comments = comments != 0 && comments*2 >= pass.hash_lines.size();
+      const size_t rows = pass.data_lines + (hash_comments ? 0 : pass.hash_lines.size());
+
+      d.sep = best < 0 ? ',' : candidate_seps[best];
+      d.qchar = pass.qchar;
+      d.comment = hash_comments ? '#' : 0;
+      d.crlf = pass.crlf_lines*2 > pass.data_lines + pass.hash_lines.size();
+      d.trim_whitespace = best >= 0 && pass.spaces_after[best]*2 > pass.seps[best];
+      d.columns = best < 0 ? 1 : best_count + 1;
+      d.rows = rows;
+      d.confidence = best < 0 ? 0 : std::max(0.0, best_share - second_share/2);
+      if (rows < 2)
+         d.confidence /= 2;
+      if (pass.qchar)
+         d.quote_confidence = double(pass.quoted_cells) / (pass.quoted_cells + pass.bad_quotes);
+      else {
+         // sure there are none when neither quote char shows up at all
+         const size_t seen = passes[1].quoted_cells + passes[1].bad_quotes + passes[2].quoted_cells + passes[2].bad_quotes;
+         d.quote_confidence = seen ? 0.5 : 1.0;
+      }
+      return false;
+   }
+
+} // namespace sniff_detail
+
+
+// Looks at up to max_bytes of data, whole lines only, unless len fits in max_bytes:
+// then data is taken to be the whole input.
+// NOTE: returns true if there was nothing to go on (not one complete line), d is unchanged then
+inline bool sniff_dialect( const char* data, size_t len, sniffed_dialect & d, size_t max_bytes = 256*1024 )
+{
+   if (len <= max_bytes)
+      return sniff_detail::sniff(data, len, true, d);
+   // up to the last newline
+   size_t n = max_bytes;
+   while (n != 0 && data[n-1] != '\n')
+      --n;
+   return sniff_detail::sniff(data, n, false, d);
+}
+
+// Reads blocks from in until there are max_bytes (or the end), into sample, and sniffs that.
+// in is not put back: parse sample first, then the rest of in, so this works on pipes too.
+// NOTE: returns true if there was nothing to go on
+inline bool sniff_source( input_source & in, std::string & sample, sniffed_dialect & d, size_t max_bytes = 256*1024 )
+{
+   sample.clear();
+   const char* data;
+   bool at_end = false;
+   while (sample.size() < max_bytes)
+   {
+      const size_t n = in.next(data);
+      if (n == 0) {
+         at_end = true;
+         break;
+      }
+      sample.append(data, n);
+   }
+   if (at_end)
+      return sniff_detail::sniff(sample.data(), sample.size(), true, d);
+   return sniff_dialect(sample.data(), sample.size(), d, std::min(sample.size()-1, max_bytes));
+}
+
+
+// Makes the fastest csv_parser for d, and returns f(parser).
+// f needs a template operator()(Parser&) that returns bool (true on error, like parse_source()).
+template <class CsvBuilder, class Function>
+bool with_sniffed_parser( CsvBuilder & out, sniffed_dialect const& d, Function & f )
+{
+   const bool trim = d.trim_whitespace;
+   if (d.comment == 0)
+   {
+      if (d.qchar == 0 && d.sep == ',') {
+         csv_parser<CsvBuilder,Disable,Separator_Comma,Disable> p(out, trim);
+         return f(p);
+      }
+      if (d.qchar == 0 && d.sep == '\t') {
+         csv_parser<CsvBuilder,Disable,Sep<'\t'>,Disable> p(out, trim);
+         return f(p);
+      }
+      if (d.qchar == '"' && d.sep == ',') {
+         csv_parser<CsvBuilder,Quote<'"'>,Sep<','>,Disable> p(out, trim);
+         return f(p);
+      }
+      if (d.qchar == '"' && d.sep == ';') {
+         csv_parser<CsvBuilder,Quote<'"'>,Sep<';'>,Disable> p(out, trim);
+         return f(p);
+      }
+      if (d.qchar == '"' && d.sep == '\t') {
+         csv_parser<CsvBuilder,Quote<'"'>,Sep<'\t'>,Disable> p(out, trim);
+         return f(p);
+      }
+   }
+   csv_parser<CsvBuilder,char,char,char> p(out, d.dialect());
+   return f(p);
+}
+
+
+} // namespace cppcsv
@@ -0,0 +1,345 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Input sources for csv_parser, so you don't need to write your own read loop:
+//
+//    cppcsv::csv_parser<MyBuilder> parser(builder, '"', ',');
+//    if (cppcsv::parse_file(parser, "input.csv"))
+//       printf("error: %s\n", parser.error());
+//
+// file_source memory maps regular files (with sequential read-ahead advice),
+// so the parser reads straight from the page cache, and with
+// csv_parser::set_zero_copy(true) most cells are never copied at all.
+// Pipes, terminals etc (or if mapping fails) are read with fread() instead.
+//
+// I/O errors are thrown as std::runtime_error.
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#ifdef _WIN32
+#  ifndef WIN32_LEAN_AND_MEAN
+#     define WIN32_LEAN_AND_MEAN 1
+#  endif
+#  ifndef NOMINMAX
+#     define NOMINMAX 1
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace cppcsv {
+
+
+// Hands out the input one block at a time
+class input_source {
+public:
+   virtual ~input_source() {}
+
+   // points data at the next block and returns its length, or 0 at the end of the input.
+   // The block stays valid until the next call.
+   virtual size_t next( const char*& data ) = 0;
+
+   // bytes handed out so far
+   virtual boost::uint64_t position() const = 0;
+
+   // total bytes, or 0 if not known (eg a pipe)
+   virtual boost::uint64_t size() const = 0;
+
+   // bytes read from the underlying file or buffer so far, for progress against its size:
+   // the same as position() unless the source decompresses (or reads ahead)
+   virtual boost::uint64_t raw_position() const { return position(); }
+
+   // makes the next block start at offset, returns false if that can't be done (eg a pipe)
+   virtual bool seek( boost::uint64_t ) { return false; }
+};
+
+
+
+// A file, memory mapped if possible, otherwise read in blocks.
+class file_source : public input_source {
+   // noncopyable
+   file_source( file_source const& );
+   file_source& operator=( file_source const& );
+
+public:
+   static const size_t default_read_size = 64*1024;
+
+   // block_size: how much next() hands out at once,
+   // 0 means the whole mapping at once (or default_read_size when reading)
+   explicit file_source( const char* filename, size_t block_size = 0 ) :
+      fp(NULL),
+      own_fp(false),
+      map_begin(NULL),
+      map_size(0),
+      total_size(0),
+      pos(0),
+      block_size(block_size)
+   {
+      if (!map_file(filename) && fp == NULL)
+      {
+         fp = fopen(filename, "rb");
+         if (fp == NULL)
+            throw std::runtime_error("Could not open input file " + std::string(filename));
+         own_fp = true;
+      }
+   }
+
+   // reads from an open file (eg stdin), does not close it
+   explicit file_source( FILE* fp, size_t block_size = 0 ) :
+      fp(fp),
+      own_fp(false),
+      map_begin(NULL),
+      map_size(0),
+      total_size(0),
+      pos(0),
+      block_size(block_size)
+   {
+   }
+
+   ~file_source()
+   {
+      unmap();
+      if (own_fp)
+         fclose(fp);
+   }
+
+   bool is_mapped() const { return map_begin != NULL; }
+
+   // all of the file when it is mapped, otherwise NULL
+   const char* mapped_data() const { return map_begin; }
+
+   boost::uint64_t position() const { return pos; }
+   boost::uint64_t size() const { return total_size; }
+
+   size_t next( const char*& data )
+   {
+      if (!fp)
+      {
+         // mapped (or an empty file)
+         size_t n = map_size - static_cast<size_t>(pos);
+         if (block_size != 0 && n > block_size)
+            n = block_size;
+         data = map_begin + static_cast<size_t>(pos);
+         pos += n;
+         return n;
+      }
+
+      buffer.resize(block_size ? block_size : default_read_size);
+      const size_t n = fread(&buffer[0], 1, buffer.size(), fp);
+      if (n == 0 && ferror(fp))
+         throw std::runtime_error("Error reading from input file");
+      data = &buffer[0];
+      pos += n;
+      return n;
+   }
+
+   bool seek( boost::uint64_t offset )
+   {
+      if (!fp)
+      {
+         if (offset > map_size)
+            return false;
+      }
+#ifdef _WIN32
+      else if (_fseeki64(fp, offset, SEEK_SET) != 0)
+         return false;
+#else
+      else if (fseeko(fp, offset, SEEK_SET) != 0)
+         return false;
+#endif
+      pos = offset;
+      return true;
+   }
+
+private:
+   FILE* fp;          // NULL when mapped
+   bool own_fp;
+   const char* map_begin;
+   size_t map_size;
+   boost::uint64_t total_size;
+   boost::uint64_t pos;
+   size_t block_size;
+   std::vector<char> buffer;
+
+#ifdef _WIN32
+   bool map_file( const char* filename )
+   {
+      HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if (file == INVALID_HANDLE_VALUE)
+         return false;
+
+      LARGE_INTEGER s;
+      if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &s) ||
+          static_cast<boost::uint64_t>(s.QuadPart) > static_cast<size_t>(-1))
+      {
+         CloseHandle(file);
+         return false;
+      }
+
+      total_size = s.QuadPart;
+      if (total_size == 0)
+      {
+         // nothing to map
+         CloseHandle(file);
+         return true;
+      }
+
+      HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      CloseHandle(file);   // the mapping keeps it open
+      if (mapping == NULL)
+         return false;
+
+      map_begin = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      CloseHandle(mapping);   // the view keeps it open
+      if (map_begin == NULL)
+         return false;
+
+      map_size = static_cast<size_t>(total_size);
+      return true;
+   }
+
+   void unmap()
+   {
+      if (map_begin)
+         UnmapViewOfFile(map_begin);
+   }
+#else
+   // returns false if it can't be mapped, with fp set to the file already opened if there is one:
+   // opening a pipe again would leave the writer with no reader in between
+   bool map_file( const char* filename )
+   {
+      const int fd = open(filename, O_RDONLY);
+      if (fd < 0)
+         return false;
+
+      struct stat sb;
+      if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+          static_cast<boost::uint64_t>(sb.st_size) > static_cast<size_t>(-1))
+      {
+         read_fd(fd, filename);   // pipe etc, read it instead
+         return false;
+      }
+
+      total_size = sb.st_size;
+      if (total_size == 0)
+      {
+         // mmap does not like zero length
+         close(fd);
+         return true;
+      }
+
+      void* p = mmap(NULL, static_cast<size_t>(total_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED)
+      {
+         read_fd(fd, filename);
+         return false;
+      }
+      close(fd);   // the mapping keeps it open
+
+#ifdef MADV_SEQUENTIAL
+      madvise(p, static_cast<size_t>(total_size), MADV_SEQUENTIAL);
+#endif
+
+      map_begin = static_cast<const char*>(p);
+      map_size = static_cast<size_t>(total_size);
+      return true;
+   }
+
+   void unmap()
+   {
+      if (map_begin)
+         munmap(const_cast<char*>(map_begin), map_size);
+   }
+
+   void read_fd( int fd, const char* filename )
+   {
+      fp = fdopen(fd, "rb");
+      if (fp == NULL)
+      {
+         close(fd);
+         throw std::runtime_error("Could not open input file " + std::string(filename));
+      }
+      own_fp = true;
+   }
+#endif
+};
+
+
+
+// A buffer already in memory, handed out in blocks
+class memory_source : public input_source {
+public:
+   // block_size 0 means the whole buffer at once
+   memory_source( const char* data, size_t len, size_t block_size = 0 ) :
+      data(data),
+      len(len),
+      pos(0),
+      block_size(block_size)
+   {
+   }
+
+   boost::uint64_t position() const { return pos; }
+   boost::uint64_t size() const { return len; }
+
+   size_t next( const char*& block )
+   {
+      size_t n = len - pos;
+      if (block_size != 0 && n > block_size)
+         n = block_size;
+      block = data + pos;
+      pos += n;
+      return n;
+   }
+
+   bool seek( boost::uint64_t offset )
+   {
+      if (offset > len)
+         return false;
+      pos = static_cast<size_t>(offset);
+      return true;
+   }
+
+private:
+   const char* data;
+   size_t len;
+   size_t pos;
+   size_t block_size;
+};
+
+
+
+// feeds everything from source to the parser, then flushes
+// NOTE: returns true on error, like csv_parser
+template <class Parser>
+bool parse_source( Parser & parser, input_source & source )
+{
+   const char* data;
+   while (size_t n = source.next(data))
+   {
+      const char* cursor = data;
+      if (parser.process_chunk(cursor, n))
+         return true;
+   }
+   return parser.flush();
+}
+
+// same, for a whole file
+template <class Parser>
+bool parse_file( Parser & parser, const char* filename )
+{
+   file_source source(filename);
+   return parse_source(parser, source);
+}
+
+
+} // namespace cppcsv
@@ -0,0 +1,114 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// What a csv_parser has seen, to tell whether a slow job is spending its time
+// in the parser or in the builder:
+//
+//    // compile everything with -DCPPCSV_STATS
+//    parser.set_stats_sampling(64);   // optional, times every 64th row
+//    ... parse ...
+//    cppcsv::csv_stats s = parser.stats();
+//    printf("%llu rows, builder %.0f%% of the time\n", s.rows, 100*s.builder_fraction());
+//
+// Without CPPCSV_STATS the counters are compiled out, nothing is counted or timed,
+// and stats() gives all zeros (with enabled false).
+// Define it (or not) the same way in every file that includes csvparser.hpp.
+
+#include <boost/cstdint.hpp>
+
+#ifdef CPPCSV_STATS
+#  ifdef _WIN32
+#     ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN 1
+#     endif
+#     ifndef NOMINMAX
+#        define NOMINMAX 1
+#     endif
+#     include <windows.h>
+#  else
+#     include <time.h>
+#  endif
+#  define CPPCSV_STAT(x) x
+#else
+#  define CPPCSV_STAT(x)
+#endif
+
+namespace cppcsv {
+
+
+struct csv_stats {
+   bool enabled;                      // compiled with CPPCSV_STATS
+
+   boost::uint64_t bytes;             // given to process_chunk()
+   boost::uint64_t rows;              // handed to the builder
+   boost::uint64_t cells;
+   boost::uint64_t quoted_cells;
+   boost::uint64_t escaped_quotes;    // doubled quote chars inside quoted cells
+   boost::uint64_t crlf_rows;         // rows that ended with \r\n
+   boost::uint64_t comment_lines;
+   boost::uint64_t max_row_bytes;     // of cell content, after unquoting
+   boost::uint64_t max_cell_bytes;
+   boost::uint64_t buffer_growths;    // times the cell buffers had to grow
+
+   // only with csv_parser::set_stats_sampling()
+   boost::uint64_t parse_ns;          // in process_chunk() and flush(), builder calls included
+   boost::uint64_t builder_ns;        // in builder calls, estimated from the sampled rows
+   boost::uint64_t sampled_rows;
+   boost::uint64_t sampled_builder_ns;
+
+   csv_stats() :
+      enabled(false),
+      bytes(0), rows(0), cells(0), quoted_cells(0), escaped_quotes(0), crlf_rows(0), comment_lines(0),
+      max_row_bytes(0), max_cell_bytes(0), buffer_growths(0),
+      parse_ns(0), builder_ns(0), sampled_rows(0), sampled_builder_ns(0)
+   {
+   }
+
+   // of parse_ns, 0 if not timed
+   double builder_fraction() const
+   {
+      return parse_ns ? static_cast<double>(builder_ns) / parse_ns : 0.0;
+   }
+};
+
+
+#ifdef CPPCSV_STATS
+
+// adds the nanoseconds until it goes out of scope to *ns, unless ns is NULL
+class stats_timer {
+   stats_timer( stats_timer const& );
+   stats_timer& operator=( stats_timer const& );
+
+public:
+   explicit stats_timer( boost::uint64_t* ns ) : ns(ns), start(ns ? now_ns() : 0) {}
+
+   ~stats_timer()
+   {
+      if (ns)
+         *ns += now_ns() - start;
+   }
+
+   static boost::uint64_t now_ns()
+   {
+#ifdef _WIN32
+      LARGE_INTEGER t, f;
+      QueryPerformanceCounter(&t);
+      QueryPerformanceFrequency(&f);
+      return static_cast<boost::uint64_t>(t.QuadPart / f.QuadPart * 1000000000 + t.QuadPart % f.QuadPart * 1000000000 / f.QuadPart);
+#else
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+   }
+
+private:
+   boost::uint64_t* ns;
+   boost::uint64_t start;
+};
+
+#endif
+
+
+} // namespace cppcsv
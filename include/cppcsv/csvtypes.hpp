@@ -0,0 +1,467 @@
+#pragma once
+
+// License: http://opensource.org/licenses/MIT
+
+// Typed cells: numbers, bools and dates decoded straight from the cell spans,
+// without copying them or going through the C locale:
+//
+//    struct MyRows {
+//       void row( const cppcsv::typed_value* values, size_t num_cells, size_t file_row, size_t num_errors );
+//    };
+//
+//    cppcsv::csv_schema schema;
+//    schema.add(cppcsv::field_int64).add(cppcsv::field_string).add(cppcsv::field_double);
+//    MyRows rows;
+//    cppcsv::typed_builder<MyRows> builder(schema, rows);
+//    cppcsv::csv_parser<cppcsv::typed_builder<MyRows> > parser(builder, '"', ',');
+//    parser.set_zero_copy(true);
+//
+// The parse_*() functions work on any (pointer, length), eg a cell handed to a builder.
+// They allow spaces and tabs around the value, nothing else.
+//
+// Numbers: eight digits at a time are checked and added up in one 64 bit word (SWAR),
+// doubles with up to 19 significant digits and a small enough exponent are exact
+// with one multiply or divide (always correctly rounded), anything else
+// goes to std::from_chars if the library has it, or strtod() with the locale's decimal point.
+
+#include "csvbase.hpp"
+
+#include <boost/cstdint.hpp>
+
+#include <cctype>
+#include <cerrno>
+#include <clocale>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#  if __has_include(<charconv>)
+#     include <charconv>
+#     if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#        define CPPCSV_FROM_CHARS_DOUBLE 1
+#     endif
+#  endif
+#endif
+
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_IX86) || defined(_M_X64)
+#  define CPPCSV_LITTLE_ENDIAN 1
+#endif
+
+namespace cppcsv {
+
+
+enum field_type {
+   field_string,
+   field_int64,
+   field_double,
+   field_bool,     // true/false, t/f, yes/no, y/n, 1/0, any case
+   field_date      // YYYY-MM-DD, as days since 1970-01-01
+};
+
+// 0 is no error, so these can be tested like the "returns true on error" functions
+enum field_error {
+   field_ok = 0,
+   field_bad_syntax,
+   field_out_of_range
+};
+
+inline const char* field_error_text( field_error e )
+{
+   switch (e) {
+      case field_ok:           return "ok";
+      case field_bad_syntax:   return "bad syntax";
+      case field_out_of_range: return "out of range";
+   }
+   return "?";
+}
+
+
+namespace types_detail {
+
+   inline bool is_digit( char c ) { return static_cast<unsigned char>(c - '0') < 10; }
+
+   // drops spaces and tabs from both ends
+   inline void trim( const char*& p, const char*& end )
+   {
+      while (p != end && (*p == ' ' || *p == '\t'))
+         ++p;
+      while (p != end && (end[-1] == ' ' || end[-1] == '\t'))
+         --end;
+   }
+
+#ifdef CPPCSV_LITTLE_ENDIAN
+   inline boost::uint64_t load8( const char* p )
+   {
+      boost::uint64_t v;
+      memcpy(&v, p, 8);
+      return v;
+   }
+
+   inline bool is_eight_digits( boost::uint64_t v )
+   {
+      return (((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+            == 0x3333333333333333ULL);
+   }
+
+   // the value of eight ASCII digits, first one the most significant
+   inline boost::uint32_t eight_digits( boost::uint64_t v )
+   {
+      const boost::uint64_t mask = 0x000000FF000000FFULL;
+      const boost::uint64_t mul1 = 100 + (1000000ULL << 32);
+      const boost::uint64_t mul2 = 1 + (10000ULL << 32);
+      v -= 0x3030303030303030ULL;
+      v = (v * 10) + (v >> 8);
+      v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+      return static_cast<boost::uint32_t>(v);
+   }
+#endif
+
+   // Adds digits to v while there are any, and while there are less than max_digits in v.
+   // n counts the digits in v.
+   inline const char* digits( const char* p, const char* end, boost::uint64_t& v, int& n, int max_digits )
+   {
+#ifdef CPPCSV_LITTLE_ENDIAN
+      while (end - p >= 8 && n + 8 <= max_digits)
+      {
+         const boost::uint64_t w = load8(p);
+         if (!is_eight_digits(w))
+            break;
+         v = v * 100000000 + eight_digits(w);
+         n += 8;
+         p += 8;
+      }
+#endif
+      while (p != end && n < max_digits && is_digit(*p))
+      {
+         v = v * 10 + (*p - '0');
+         ++n;
+         ++p;
+      }
+      return p;
+   }
+
+   inline const char* skip_zeros( const char* p, const char* end )
+   {
+      while (p != end && *p == '0')
+         ++p;
+      return p;
+   }
+
+   // anything the fast path can't do exactly
+   inline field_error slow_double( const char* p, const char* end, double& out )
+   {
+      if (p != end && *p == '+') {
+         ++p;   // neither takes a +
+         if (p != end && *p == '-')
+            return field_bad_syntax;
+      }
+#ifdef CPPCSV_FROM_CHARS_DOUBLE
+      const std::from_chars_result r = std::from_chars(p, end, out);
+      if (r.ec == std::errc::result_out_of_range)
+         return field_out_of_range;
+      if (r.ec != std::errc() || r.ptr != end)
+         return field_bad_syntax;
+      return field_ok;
+#else
+      // strtod needs a terminated copy, with the locale's decimal point
+      std::string copy(p, end);
+      const char point = *localeconv()->decimal_point;
+      if (point != '.') {
+         for (size_t i = 0; i != copy.size(); ++i)
+            if (copy[i] == '.')
+               copy[i] = point;
+            else if (copy[i] == point)
+               return field_bad_syntax;
+      }
+      if (copy.empty() || isspace(static_cast<unsigned char>(copy[0])))
+         return field_bad_syntax;   // strtod skips it
+      char* parsed;
+      errno = 0;
+      const double v = strtod(copy.c_str(), &parsed);
+      if (parsed != copy.c_str() + copy.size())
+         return field_bad_syntax;
+      if (errno == ERANGE)
+         return field_out_of_range;   // as from_chars, too small is out of range too
+      out = v;
+      return field_ok;
+#endif
+   }
+
+   // days since 1970-01-01 for a date in the proleptic Gregorian calendar
+   inline boost::int64_t days_from_civil( int y, int m, int d )
+   {
+      y -= m <= 2;
+      const int era = (y >= 0 ? y : y - 399) / 400;
+      const int yoe = y - era * 400;
+      const int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+      const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+      return static_cast<boost::int64_t>(era) * 146097 + doe - 719468;
+   }
+
+   inline bool same_nocase( const char* p, size_t len, const char* word )
+   {
+      for (size_t i = 0; i != len; ++i)
+      {
+         const char c = (p[i] >= 'A' && p[i] <= 'Z') ? p[i] + ('a' - 'A') : p[i];
+         if (word[i] == '\0' || c != word[i])
+            return false;
+      }
+      return word[len] == '\0';
+   }
+
+} // namespace types_detail
+
+
+// NOTE: all of these return field_ok (0) on success, out is unchanged on error
+
+inline field_error parse_int64( const char* p, size_t len, boost::int64_t& out )
+{
+   using namespace types_detail;
+   const char* end = p + len;
+   trim(p, end);
+   const bool neg = p != end && *p == '-';
+   if (p != end && (*p == '-' || *p == '+'))
+      ++p;
+   if (p == end || !is_digit(*p))
+      return field_bad_syntax;
+
+   p = skip_zeros(p, end);
+   boost::uint64_t v = 0;
+   int n = 0;
+   p = digits(p, end, v, n, 19);
+   if (p != end)
+      return is_digit(*p) ? field_out_of_range : field_bad_syntax;
+
+   const boost::uint64_t limit = static_cast<boost::uint64_t>(1) << 63;
+   if (v > limit - (neg ? 0 : 1))
+      return field_out_of_range;
+   out = neg ? static_cast<boost::int64_t>(0 - v) : static_cast<boost::int64_t>(v);
+   return field_ok;
+}
+
+inline field_error parse_double( const char* p, size_t len, double& out )
+{
+   using namespace types_detail;
+   const char* end = p + len;
+   trim(p, end);
+   const char* const start = p;
+   const bool neg = p != end && *p == '-';
+   if (p != end && (*p == '-' || *p == '+'))
+      ++p;
+
+   // mantissa digits, then the exponent
+   const char* const first = p;
+   p = skip_zeros(p, end);
+   boost::uint64_t m = 0;
+   int n = 0;
+   p = digits(p, end, m, n, 19);
+   bool exact = p == end || !is_digit(*p);
+   int exp10 = 0;
+   while (p != end && is_digit(*p)) {
+      ++exp10;   // past 19 digits
+      ++p;
+   }
+   bool any = p != first;
+   if (p != end && *p == '.')
+   {
+      const char* const frac = ++p;
+      if (m == 0)
+      {
+         // 0.000123: the zeros only move the point
+         const char* nz = skip_zeros(p, end);
+         exp10 -= static_cast<int>(nz - p);
+         p = nz;
+      }
+      const char* q = digits(p, end, m, n, 19);
+      exp10 -= static_cast<int>(q - p);
+      p = q;
+      while (p != end && is_digit(*p)) {
+         exact = false;
+         ++p;
+      }
+      any = any || p != frac;
+   }
+   if (!any)
+      return slow_double(start, end, out);   // inf, nan, or nothing
+
+   if (p != end && (*p == 'e' || *p == 'E'))
+   {
+      ++p;
+      const bool eneg = p != end && *p == '-';
+      if (p != end && (*p == '-' || *p == '+'))
+         ++p;
+      if (p == end || !is_digit(*p))
+         return field_bad_syntax;
+      int e = 0;
+      for ( ; p != end && is_digit(*p); ++p)
+         if (e < 100000)
+            e = e * 10 + (*p - '0');
+      exp10 += eneg ? -e : e;
+   }
+   if (p != end)
+      return field_bad_syntax;
+
+   // both m and 10^|exp10| are exact doubles, so one operation rounds correctly
+   static const double pow10[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+   };
+   if (exact && m <= (static_cast<boost::uint64_t>(1) << 53) && exp10 >= -22 && exp10 <= 22)
+   {
+      double d = static_cast<double>(m);
+      d = exp10 < 0 ? d / pow10[-exp10] : d * pow10[exp10];
+      out = neg ? -d : d;
+      return field_ok;
+   }
+   if (m == 0 && exact)
+   {
+      out = neg ? -0.0 : 0.0;
+      return field_ok;
+   }
+   return slow_double(start, end, out);
+}
+
+inline field_error parse_bool( const char* p, size_t len, bool& out )
+{
+   using namespace types_detail;
+   const char* end = p + len;
+   trim(p, end);
+   const size_t n = end - p;
+   if (same_nocase(p, n, "true") || same_nocase(p, n, "t") || same_nocase(p, n, "yes") || same_nocase(p, n, "y") || same_nocase(p, n, "1"))
+      out = true;
+   else if (same_nocase(p, n, "false") || same_nocase(p, n, "f") || same_nocase(p, n, "no") || same_nocase(p, n, "n") || same_nocase(p, n, "0"))
+      out = false;
+   else
+      return field_bad_syntax;
+   return field_ok;
+}
+
+// YYYY-MM-DD, out is the days since 1970-01-01 (negative before)
+inline field_error parse_date( const char* p, size_t len, boost::int64_t& out )
+{
+   using namespace types_detail;
+   const char* end = p + len;
+   trim(p, end);
+   if (end - p != 10 || p[4] != '-' || p[7] != '-')
+      return field_bad_syntax;
+   for (int i = 0; i != 10; ++i)
+      if (i != 4 && i != 7 && !is_digit(p[i]))
+         return field_bad_syntax;
+
+   const int y = (p[0]-'0')*1000 + (p[1]-'0')*100 + (p[2]-'0')*10 + (p[3]-'0');
+   const int m = (p[5]-'0')*10 + (p[6]-'0');
+   const int d = (p[8]-'0')*10 + (p[9]-'0');
+   static const int month_days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+   const bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+   if (m < 1 || m > 12 || d < 1 || d > month_days[m-1] + (m == 2 && leap))
+      return field_out_of_range;
+   out = days_from_civil(y, m, d);
+   return field_ok;
+}
+
+
+// one decoded cell
+struct typed_value {
+   field_type type;
+   field_error error;      // field_ok unless the cell is not a valid one of type
+   bool null;              // a NULL or empty cell (not an error), the value is 0
+   boost::int64_t i;       // field_int64, and field_date as days since 1970-01-01
+   double d;               // field_double
+   bool b;                 // field_bool
+   const char* str;        // the cell as it was, for every type (NULL for a NULL cell)
+   size_t len;
+};
+
+// Decodes one cell as type t.
+// NOTE: returns the error, also in v.error
+inline field_error decode_cell( field_type t, const char* data, size_t len, typed_value& v )
+{
+   v.type = t;
+   v.error = field_ok;
+   v.null = data == NULL || len == 0;
+   v.i = 0;
+   v.d = 0;
+   v.b = false;
+   v.str = data;
+   v.len = len;
+   if (v.null)
+      return field_ok;
+   switch (t)
+   {
+      case field_string: break;
+      case field_int64:  v.error = parse_int64(data, len, v.i); break;
+      case field_double: v.error = parse_double(data, len, v.d); break;
+      case field_bool:   v.error = parse_bool(data, len, v.b); break;
+      case field_date:   v.error = parse_date(data, len, v.i); break;
+   }
+   return v.error;
+}
+
+
+// The type of each column, columns past the end are strings.
+class csv_schema {
+public:
+   csv_schema() {}
+
+   csv_schema& add( field_type t )
+   {
+      types.push_back(t);
+      return *this;
+   }
+
+   void set( size_t col, field_type t )
+   {
+      if (col >= types.size())
+         types.resize(col+1, field_string);
+      types[col] = t;
+   }
+
+   field_type type_of( size_t col ) const
+   {
+      return col < types.size() ? types[col] : field_string;
+   }
+
+   size_t size() const { return types.size(); }
+
+   // Decodes a row into values (resized to num_cells).
+   // NOTE: returns the number of cells with errors
+   size_t decode( const cell_span* cells, size_t num_cells, std::vector<typed_value>& values ) const
+   {
+      values.resize(num_cells);
+      size_t errors = 0;
+      for (size_t i = 0; i != num_cells; ++i)
+         if (decode_cell(type_of(i), cells[i].data, cells[i].len, values[i]))
+            ++errors;
+      return errors;
+   }
+
+private:
+   std::vector<field_type> types;
+};
+
+
+// A per_row_span_tag builder that decodes every row with a schema, and calls
+//    consumer.row(const typed_value* values, size_t num_cells, size_t file_row, size_t num_errors)
+// values is only valid during the call (strings point into the parser's buffers).
+template <class Consumer>
+class typed_builder : public per_row_span_tag {
+public:
+   typed_builder( csv_schema const& schema, Consumer& consumer ) : schema(schema), consumer(consumer) {}
+
+   void end_full_row( const cell_span* cells, size_t num_cells, size_t file_row )
+   {
+      const size_t errors = schema.decode(cells, num_cells, values);
+      consumer.row(num_cells ? &values[0] : NULL, num_cells, file_row, errors);
+   }
+
+private:
+   csv_schema const& schema;
+   Consumer& consumer;
+   std::vector<typed_value> values;
+};
+
+
+} // namespace cppcsv
@@ -1,11 +1,35 @@
+#include <cppcsv/csvbatch.hpp>
+#include <cppcsv/csvcount.hpp>
+#include <cppcsv/csvdecompress.hpp>
+#ifdef __linux__
+#  include <cppcsv/csvdirect.hpp>
+#endif
+#include <cppcsv/csvindex.hpp>
 #include <cppcsv/csvparser.hpp>
+#include <cppcsv/csvreader.hpp>
+#include <cppcsv/csvparallel.hpp>
+#include <cppcsv/csvpardecompress.hpp>
+#include <cppcsv/csvprefetch.hpp>
+#include <cppcsv/csvsniff.hpp>
+#include <cppcsv/csvsource.hpp>
+#include <cppcsv/csvtypes.hpp>
 #include <cppcsv/csvwriter.hpp>
 #include <cppcsv/simplecsv.hpp>
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <fstream>
+#include <string>
+#include <vector>
 #include <boost/array.hpp>
+#include <boost/thread/thread.hpp>
+
+#ifndef _WIN32
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
 
 #include "test_csv_2.hpp"
 
@@ -103,6 +127,489 @@ struct print_bulk_row_t : public cppcsv::per_row_tag
 
 
 
+// for testing span row interface
+static void print_span_row( const cppcsv::cell_span* cells, size_t num_cells, size_t file_row )
+{
+  printf("ROW %llu (%llu cells): ", (unsigned long long)file_row, (unsigned long long)num_cells);
+  for (size_t i = 0; i != num_cells; ++i) {
+    if (!cells[i].data) {
+      printf("(null) ");
+    } else {
+      printf("[%.*s] ", static_cast<int>(cells[i].len), cells[i].data);
+    }
+  }
+  printf("\n");
+}
+
+
+
+// counts cells that point straight into the input, for testing zero-copy
+struct view_count_builder : public cppcsv::per_cell_tag
+{
+  const char* input_begin;
+  const char* input_end;
+  int in_input, copied, nulls;
+
+  view_count_builder( std::string const& input ) :
+    input_begin(input.c_str()), input_end(input.c_str() + input.size()),
+    in_input(0), copied(0), nulls(0) {}
+
+  void begin_row() {}
+  void cell( const char *buf, size_t len ) {
+    if (!buf)
+      ++nulls;
+    else if (buf >= input_begin && buf + len <= input_end)
+      ++in_input;
+    else
+      ++copied;
+  }
+  void end_row() {}
+};
+
+
+
+// records every builder call, for comparing parser configurations
+class record_builder : public cppcsv::per_cell_tag {
+public:
+  std::string events;
+
+  void begin_row() {
+    events += "<";
+  }
+  void cell(const char *buf, size_t len) {
+    if (!buf) {
+      events += "(null)";
+    } else {
+      events += "[";
+      events.append(buf, len);
+      events += "]";
+    }
+  }
+  void end_row() {
+    events += ">\n";
+  }
+};
+
+// per_batch_tag, the rows in the same format as record_row_builder,
+// or with keep, takes the batches and records them after the parse (see kept_events())
+class record_batch_builder : public cppcsv::per_batch_tag {
+public:
+  std::string events;
+  size_t batches;
+  bool keep;
+  std::vector<cppcsv::csv_batch> kept;
+
+  record_batch_builder( bool keep = false ) : batches(0), keep(keep) {}
+
+  void end_full_rows( cppcsv::csv_batch & batch ) {
+    ++batches;
+    if (keep) {
+      kept.push_back(cppcsv::csv_batch());
+      kept.back().swap(batch);
+    }
+    else
+      record(batch);
+  }
+
+  std::string kept_events() {
+    for (size_t i = 0; i != kept.size(); ++i)
+      record(kept[i]);
+    return events;
+  }
+
+private:
+  void record( cppcsv::csv_batch const& batch ) {
+    for (size_t r = 0; r != batch.num_rows(); ++r) {
+      char row[32];
+      sprintf(row, "%llu<", (unsigned long long)batch.file_rows[r]);
+      events += row;
+      const size_t* offsets = batch.offsets(r);
+      for (size_t c = 0; c != batch.num_cells(r); ++c) {
+        events += "[";
+        events.append(batch.data() + offsets[c], offsets[c+1] - offsets[c]);
+        events += "]";
+      }
+      events += ">\n";
+    }
+  }
+};
+
+static void write_file( const char* filename, std::string const* data )
+{
+  FILE* fp = fopen(filename, "wb");
+  if (fp == NULL)
+    return;
+  fwrite(data->data(), 1, data->size(), fp);
+  fclose(fp);
+}
+
+static void read_file( const char* filename, std::vector<char> & buffer )
+{
+  std::ifstream in;
+  open_check(filename, in);
+  in.seekg (0, in.end);
+  size_t length = static_cast<size_t>(in.tellg());
+  in.seekg (0, in.beg);
+  buffer.resize(length);
+  if (length > 0)
+    in.read(&buffer[0], length);
+}
+
+// records every row, for comparing the parallel parser
+class record_row_builder : public cppcsv::per_row_tag {
+public:
+  std::string events;
+
+  void end_full_row( char* buffer, size_t num_cells, const size_t * offsets, size_t file_row ) {
+    char row[32];
+    sprintf(row, "%llu<", (unsigned long long)file_row);
+    events += row;
+    for (size_t i = 0; i != num_cells; ++i) {
+      events += "[";
+      events.append(buffer + offsets[i], offsets[i+1] - offsets[i]);
+      events += "]";
+    }
+    events += ">\n";
+  }
+};
+
+// same, through the span interface
+class record_span_builder : public cppcsv::per_row_span_tag {
+public:
+  std::string events;
+
+  void end_full_row( const cppcsv::cell_span* cells, size_t num_cells, size_t file_row ) {
+    char row[32];
+    sprintf(row, "%llu<", (unsigned long long)file_row);
+    events += row;
+    for (size_t i = 0; i != num_cells; ++i) {
+      events += cells[i].data ? "[" : "(null)[";
+      if (cells[i].data)
+        events.append(cells[i].data, cells[i].len);
+      events += "]";
+    }
+    events += ">\n";
+  }
+};
+
+// just counts rows, for checking count_rows()
+class count_row_builder : public cppcsv::per_row_tag {
+public:
+  size_t rows;
+  count_row_builder() : rows(0) {}
+  void end_full_row( char*, size_t, const size_t *, size_t ) { ++rows; }
+};
+
+// one gzip member
+static std::string gzip_string( std::string const& input )
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&zs, input.size()), '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  zs.avail_in = static_cast<uInt>(input.size());
+  zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  zs.avail_out = static_cast<uInt>(out.size());
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+// BGZF: gzip members of block_size bytes each, with their length in a BC extra field,
+// then the empty end of file member
+static std::string bgzf_string( std::string const& input, size_t block_size )
+{
+  std::string out;
+  for (size_t pos = 0; ; pos += block_size)
+  {
+    const std::string part = input.substr(std::min(pos, input.size()), block_size);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);   // raw deflate, the header is ours
+    std::string body(deflateBound(&zs, part.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(part.data()));
+    zs.avail_in = static_cast<uInt>(part.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&body[0]);
+    zs.avail_out = static_cast<uInt>(body.size());
+    deflate(&zs, Z_FINISH);
+    body.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    const size_t bsize = 18 + body.size() + 8 - 1;
+    const unsigned long crc = crc32(0, reinterpret_cast<const Bytef*>(part.data()), static_cast<uInt>(part.size()));
+    const unsigned char header[18] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+        static_cast<unsigned char>(bsize), static_cast<unsigned char>(bsize >> 8) };
+    const unsigned char trailer[8] = {
+        static_cast<unsigned char>(crc), static_cast<unsigned char>(crc >> 8),
+        static_cast<unsigned char>(crc >> 16), static_cast<unsigned char>(crc >> 24),
+        static_cast<unsigned char>(part.size()), static_cast<unsigned char>(part.size() >> 8), 0, 0 };
+    out.append(reinterpret_cast<const char*>(header), sizeof(header));
+    out += body;
+    out.append(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+    if (part.empty())
+      return out;
+  }
+}
+
+// everything from a source
+static std::string drain_source( cppcsv::input_source & in )
+{
+  std::string all;
+  const char* data;
+  while (size_t n = in.next(data))
+    all.append(data, n);
+  return all;
+}
+
+// the rows from a source, as record_row_builder has them
+static std::string source_rows( cppcsv::input_source & in )
+{
+  record_row_builder rows;
+  cppcsv::csv_parser<record_row_builder,std::string,std::string,char> cp(
+        rows, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+  try {
+    if (cppcsv::parse_source(cp, in))
+      rows.events += std::string("ERROR: ") + cp.error() + "\n";
+  }
+  catch (std::runtime_error const& e) {
+    rows.events += std::string("EXCEPTION: ") + e.what() + "\n";
+  }
+  return rows.events;
+}
+
+// parses with a dialect fixed at compile time, and the same one given at runtime,
+// in small chunks, returns true if they give the same builder calls
+template <class Q, class S, class C>
+static bool record_fixed( const char* data, size_t len, char q, char sep, char comment, bool trim_whitespace )
+{
+  record_builder fixed_rec, runtime_rec;
+  cppcsv::csv_parser<record_builder,Q,S,C> fixed(fixed_rec, trim_whitespace);
+  cppcsv::csv_parser<record_builder> runtime(runtime_rec, q, sep, trim_whitespace, false, comment, true);
+  bool fixed_failed = false, runtime_failed = false;
+  for (size_t pos = 0; pos < len && !fixed_failed && !runtime_failed; pos += 5)
+  {
+    const size_t n = std::min<size_t>(5, len - pos);
+    const char* cursor = data + pos;
+    fixed_failed = fixed(cursor, n);
+    cursor = data + pos;
+    runtime_failed = runtime(cursor, n);
+  }
+  if (!fixed_failed)
+    fixed.flush();
+  if (!runtime_failed)
+    runtime.flush();
+  return fixed_rec.events == runtime_rec.events
+    && (fixed.error() == NULL) == (runtime.error() == NULL)
+    && fixed.get_current_row() == runtime.get_current_row();
+}
+
+// parses [0,split), saves a checkpoint, and parses the rest with a new parser and builder
+template <class Builder, class Dialect>
+static std::string parse_resumed( Dialect const& dialect, const char* data, size_t len, size_t split )
+{
+  typedef cppcsv::csv_parser<Builder,std::string,std::string,char> Parser;
+  Builder first, second;
+  Parser p1(first, dialect);
+  p1.set_zero_copy(true);
+  const char* cursor = data;
+  if (split && p1(cursor, split))
+    return first.events + std::string("ERROR: ") + p1.error() + "\n" + p1.error_context() + "\n";
+
+  cppcsv::csv_checkpoint cp;
+  if (p1.get_checkpoint(cp))
+    return "no checkpoint";
+  cppcsv::csv_checkpoint loaded;
+  loaded.load(cp.save());
+
+  Parser p2(second, dialect);
+  p2.set_zero_copy(true);
+  if (p2.restore_checkpoint(loaded) || loaded.input_offset != split)
+    return "not restored";
+  cursor = data + split;
+  if (!p2(cursor, len - split))
+    p2.flush();
+  std::string events = first.events + second.events;
+  if (p2.error())
+    events += std::string("ERROR: ") + p2.error() + "\n" + p2.error_context() + "\n";
+  return events;
+}
+
+// same, all in one go
+template <class Builder, class Dialect>
+static std::string parse_all( Dialect const& dialect, const char* data, size_t len )
+{
+  Builder b;
+  cppcsv::csv_parser<Builder,std::string,std::string,char> p(b, dialect);
+  p.set_zero_copy(true);
+  const char* cursor = data;
+  if (!p(cursor, len))
+    p.flush();
+  if (p.error())
+    b.events += std::string("ERROR: ") + p.error() + "\n" + p.error_context() + "\n";
+  return b.events;
+}
+
+// parses the whole buffer, then flushes, returns all the builder calls and the error
+static std::string record_parse( std::vector<char> const& buffer, bool trim_whitespace, bool collapse_separators, char comment, bool comments_at_start )
+{
+  record_builder rec;
+  cppcsv::csv_parser<record_builder,std::string,std::string,char> cp(
+        rec, std::string("\"'"), std::string(",;\t"), trim_whitespace, collapse_separators, comment, comments_at_start);
+  const char* cursor = buffer.empty() ? NULL : &buffer[0];
+  if (!cp(cursor, buffer.size()))
+    cp.flush();
+  if (cp.error())
+    rec.events += std::string("ERROR: ") + cp.error() + "\n";
+  return rec.events;
+}
+
+// for with_sniffed_parser(), parses input and says which parser it was given
+struct sniffed_parse {
+  std::string const& input;
+  const char* kind;
+
+  explicit sniffed_parse( std::string const& input ) : input(input), kind(NULL) {}
+
+  template <class Parser>
+  bool operator()( Parser & p )
+  {
+    kind = Parser::FAST_commas_no_quotes_no_comments ? "fast" : Parser::static_dialect ? "static" : "runtime";
+    const char* cursor = input.data();
+    return p(cursor, input.size()) || p.flush();
+  }
+};
+
+static void print_sniffed( const char* name, std::string const& input )
+{
+  cppcsv::sniffed_dialect d;
+  if (cppcsv::sniff_dialect(input.data(), input.size(), d)) {
+    printf("%s: nothing to go on\n", name);
+    return;
+  }
+  record_builder sniffed_rec, runtime_rec;
+  sniffed_parse f(input);
+  const bool failed = cppcsv::with_sniffed_parser(sniffed_rec, d, f);
+  cppcsv::csv_parser<record_builder> runtime(runtime_rec, d.dialect());
+  const char* cursor = input.data();
+  const bool runtime_failed = runtime(cursor, input.size()) || runtime.flush();
+  printf("%s: sep '%s' quote '%c' comment '%c'%s%s, %d columns, %d rows, confidence %.2f quotes %.2f, %s parser%s%s\n",
+      name, d.sep == '\t' ? "\\t" : std::string(1, d.sep).c_str(), d.qchar ? d.qchar : '-', d.comment ? d.comment : '-',
+      d.crlf ? " crlf" : "", d.trim_whitespace ? " trim" : "", (int)d.columns, (int)d.rows, d.confidence, d.quote_confidence,
+      f.kind, failed ? " ERROR" : "",
+      failed == runtime_failed && sniffed_rec.events == runtime_rec.events ? "" : " DIFFERENT");
+}
+
+// prints every typed row it is given
+struct typed_printer {
+  void row( const cppcsv::typed_value* values, size_t num_cells, size_t file_row, size_t num_errors )
+  {
+    printf("row %d (%d errors):", (int)file_row, (int)num_errors);
+    for (size_t i = 0; i != num_cells; ++i)
+    {
+      cppcsv::typed_value const& v = values[i];
+      if (v.error)
+        printf(" [%s: %.*s]", cppcsv::field_error_text(v.error), (int)v.len, v.str);
+      else if (v.null)
+        printf(" null");
+      else if (v.type == cppcsv::field_int64 || v.type == cppcsv::field_date)
+        printf(" %lld", (long long)v.i);
+      else if (v.type == cppcsv::field_double)
+        printf(" %.17g", v.d);
+      else if (v.type == cppcsv::field_bool)
+        printf(" %s", v.b ? "true" : "false");
+      else
+        printf(" '%.*s'", (int)v.len, v.str);
+    }
+    printf("\n");
+  }
+};
+
+// rows as text, a|b|~ with ~ for a NULL cell
+static void append_row( std::string & out, const cppcsv::cell_span* cells, size_t num_cells, size_t file_row )
+{
+  char num[32];
+  sprintf(num, "%d:", (int)file_row);
+  out += num;
+  for (size_t i = 0; i != num_cells; ++i)
+  {
+    if (i)
+      out += '|';
+    if (cells[i].data)
+      out.append(cells[i].data, cells[i].len);
+    else
+      out += '~';
+  }
+  out += '\n';
+}
+
+struct span_rows {
+  std::string* out;
+  explicit span_rows( std::string* out ) : out(out) {}
+  void operator()( const cppcsv::cell_span* cells, size_t num_cells, size_t file_row ) { append_row(*out, cells, num_cells, file_row); }
+};
+
+// short rows come back from a batch with NULLs on the end
+static std::string without_trailing_nulls( std::string const& rows )
+{
+  std::string out;
+  for (size_t pos = 0; pos < rows.size(); )
+  {
+    const size_t end = rows.find('\n', pos);
+    std::string row = rows.substr(pos, end - pos);
+    while (row.size() >= 2 && row.compare(row.size() - 2, 2, "|~") == 0)
+      row.erase(row.size() - 2);
+    if (row.size() >= 2 && row.compare(row.size() - 2, 2, ":~") == 0)
+      row.erase(row.size() - 1);
+    out += row + "\n";
+    pos = end + 1;
+  }
+  return out;
+}
+
+// the same rows, put back together from the batches (so short rows get NULLs on the end)
+struct batch_rows {
+  std::string out;
+  size_t batches;
+  bool print;
+
+  batch_rows() : batches(0), print(false) {}
+
+  void batch( cppcsv::record_batch const& b )
+  {
+    ++batches;
+    if (print)
+      printf("batch of %d rows, %d columns (%d kept), nulls:", (int)b.num_rows, (int)b.num_columns, (int)b.columns.size());
+    for (size_t c = 0; print && c != b.num_columns; ++c)
+      printf(" %d", (int)b.columns[c].null_count);
+    if (print)
+      printf("\n");
+    std::vector<cppcsv::cell_span> cells(b.num_columns);
+    for (size_t r = 0; r != b.num_rows; ++r)
+    {
+      for (size_t c = 0; c != b.num_columns; ++c)
+        cells[c].data = b.columns[c].cell(r, cells[c].len);
+      append_row(out, cells.empty() ? NULL : &cells[0], cells.size(), b.file_rows[r]);
+    }
+  }
+};
+
+static const char* const all_test_files[] = {
+  "test.csv",
+  "test_bad_dos.csv",
+  "test_bad_separator.csv",
+  "test_collapse_separators.csv",
+  "test_comment.csv",
+  "test_dos.csv",
+  "test_multiple_quotes.csv",
+  "test_no_last_newline.csv",
+  "test_whitespace_sep.csv",
+  NULL
+};
+
+
+
 int main(int argc,char **argv)
 {
 //  debug_builder dbg;
@@ -964,6 +1471,27 @@ int main(int argc,char **argv)
 }
 
 
+    printf("\n\n-- Test trailing whitespace stays in its own row ---\n\n");
+
+{
+  // it was kept for the next row, and put before that row's second char
+  const char* inputs[] = { "a,  \nb\n", "a,  \nbc\n" };
+  const char* first_cells[] = { "<[b]>", "<[bc]>" };
+  for (size_t i = 0; i != 2; ++i)
+  {
+    record_builder rec;
+    csv_parser<record_builder> cp(rec, '"', ',', false, false);   // no trimming
+    const std::string input = inputs[i];
+    const char* cursor = input.c_str();
+    if (cp(cursor, input.size()) || cp.flush())
+      printf("ERROR: %s\n", cp.error());
+    printf("%s", rec.events.c_str());
+    const size_t second = rec.events.find('\n') + 1;
+    printf("second row: %s\n", rec.events.compare(second, strlen(first_cells[i]), first_cells[i]) == 0 ? "ok" : "WRONG");
+  }
+}
+
+
     printf("\n\n-- Test per-row bulk interface, with function ---\n\n");
 
 {
@@ -1023,6 +1551,1090 @@ int main(int argc,char **argv)
 
   delete[] buffer;
 }
-  return 0;
+
+
+    printf("\n\n-- Test long cells, whole buffer vs small chunks ---\n\n");
+
+{
+  // long runs of plain content are skipped over in blocks,
+  // make sure that works the same across chunk boundaries
+  std::string input;
+  input += std::string(100, 'a') + "," + std::string(37, 'b') + "\n";
+  input += "\"" + std::string(70, 'c') + "\n" + std::string(20, 'd') + ",\"\"" + std::string(50, 'e') + "\"," + std::string(3, 'f') + "\n";
+
+  record_builder whole_rec;
+  cppcsv::csv_parser<record_builder> whole(whole_rec, '"', ',');
+  const char* cursor = input.c_str();
+  whole(cursor, input.size());
+
+  record_builder chunked_rec;
+  cppcsv::csv_parser<record_builder> chunked(chunked_rec, '"', ',');
+  for (size_t pos = 0; pos < input.size(); pos += 5)
+  {
+    cursor = input.c_str() + pos;
+    chunked(cursor, std::min<size_t>(5, input.size() - pos));
+  }
+
+  printf("cells: %d %d %d %d\n",
+        (int)std::count(whole_rec.events.begin(), whole_rec.events.end(), 'a'),
+        (int)std::count(whole_rec.events.begin(), whole_rec.events.end(), 'b'),
+        (int)std::count(whole_rec.events.begin(), whole_rec.events.end(), 'e'),
+        (int)whole_rec.events.size());
+  printf("chunked: %s\n", whole_rec.events == chunked_rec.events ? "same" : "DIFFERENT");
 }
 
+
+    printf("\n\n-- Test byte_set finds the same bytes as a plain loop ---\n\n");
+
+{
+  const std::string input = std::string(70, '-') + "x" + std::string(40, '-') + "\n" + std::string(3, '-');
+  const char* begin = input.c_str();
+  const char* end = begin + input.size();
+
+  cppcsv::scan::byte_set set;
+  printf("empty set: %s\n", set.find(begin, end) == end ? "end" : "FOUND");
+  set.insert('x');
+  set.insert('\n');
+  bool same = true;
+  for (size_t i = 0; i != input.size(); ++i)
+    same = same && set.find(begin + i, end) == set.find_plain(begin + i, end);
+  printf("every start: %s\n", same ? "same" : "DIFFERENT");
+}
+
+
+    printf("\n\n-- Test zero-copy cells ---\n\n");
+
+{
+  // escaped quotes and CRs have to be copied, the rest can point into the input
+  std::string input = "abc,\"de\"\"f\",\"plain quoted\", gh ,,x\r\n1,2\n";
+
+  view_count_builder counter(input);
+  cppcsv::csv_parser<view_count_builder> cp(counter, '"', ',', true);
+  cp.set_zero_copy(true);
+  const char* cursor = input.c_str();
+  cp(cursor, input.size());
+  printf("in input: %d, copied: %d, null: %d\n", counter.in_input, counter.copied, counter.nulls);
+
+  // same again through the span interface, split in two chunks mid-row
+  typedef cppcsv::csv_builder_span<void(*)(const cppcsv::cell_span*, size_t, size_t)> SpanBuilder;
+  SpanBuilder builder(&print_span_row);
+  cppcsv::csv_parser<SpanBuilder> span_cp(builder, '"', ',', true);
+  span_cp.set_zero_copy(true);
+  std::string first = input.substr(0, 20);
+  std::string second = input.substr(20);
+  cursor = first.c_str();
+  span_cp(cursor, first.size());
+  first.assign(first.size(), '!');   // the parser must not still point in here
+  cursor = second.c_str();
+  span_cp(cursor, second.size());
+}
+
+
+
+    printf("\n\n-- Test column projection ---\n\n");
+
+{
+  // only columns 1 and 3 are wanted, the rest come out as NULL
+  std::string input = "a,\"b\"\"b\",c,d,e\n1,\"2\n2\",3,4\n\n1,2\nx,y,z,w,v\n";
+  std::vector<size_t> columns;
+  columns.push_back(1);
+  columns.push_back(3);
+
+  typedef cppcsv::csv_builder_span<void(*)(const cppcsv::cell_span*, size_t, size_t)> SpanBuilder;
+  SpanBuilder builder(&print_span_row);
+  cppcsv::csv_parser<SpanBuilder> cp(builder, '"', ',', true, false, '#', true);
+  cp.set_zero_copy(true);
+  cp.set_projection(columns);
+  const char* cursor = input.c_str();
+  if (!cp(cursor, input.size()))
+    cp.flush();
+
+  // and per-cell, changing the projection part way through
+  debug_builder printer;
+  cppcsv::csv_parser<debug_builder> cp2(printer, '"', ',');
+  std::string first = input.substr(0, 12);
+  cursor = first.c_str();
+  cp2(cursor, first.size());
+  cp2.set_projection(columns);   // from the next row
+  std::string second = input.substr(12);
+  cursor = second.c_str();
+  if (!cp2(cursor, second.size()))
+    cp2.flush();
+}
+
+    printf("\n\n-- Test parallel parser gives the same rows as csv_parser ---\n\n");
+
+{
+  std::vector<std::string> inputs;
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    inputs.push_back(std::string(buffer.begin(), buffer.end()));
+  }
+  // quoted cells over several lines, to make the ranges start inside quotes
+  std::string multiline;
+  for (int i = 0; i != 50; ++i)
+    multiline += "a,\"b\n\nc\n,d\",\"\"\"\ne\n\"\n 'x\n' ,y\n";
+  inputs.push_back(multiline);
+
+  typedef cppcsv::csv_dialect<std::string,std::string,char> Dialect;
+  for (size_t n = 0; n != inputs.size(); ++n)
+  {
+    std::string const& input = inputs[n];
+    bool same = true;
+    for (int opts = 0; opts != 4; ++opts)
+    {
+      Dialect dialect("\"'", ",;\t", (opts & 1) != 0, (opts & 2) != 0, '#', true, true);
+
+      record_row_builder seq;
+      cppcsv::csv_parser<record_row_builder,std::string,std::string,char> cp(seq, dialect);
+      const char* cursor = input.c_str();
+      if (!cp(cursor, input.size()))
+        cp.flush();
+      if (cp.error())
+        seq.events += std::string("ERROR: ") + cp.error() + "\n" + cp.error_context() + "\n";
+
+      for (size_t chunk = 1; chunk < 64; chunk += 7)
+      {
+        record_row_builder par;
+        cppcsv::parallel_csv_parser<record_row_builder,std::string,std::string,char> pp(par, dialect, 3);
+        pp.set_chunk_size(chunk);
+        if (pp.parse(input.c_str(), input.size()))
+          par.events += std::string("ERROR: ") + pp.error() + "\n" + pp.error_context() + "\n";
+        same = same && seq.events == par.events && cp.get_current_row() == pp.get_current_row();
+      }
+    }
+    printf("%s: %s\n", n < inputs.size()-1 ? all_test_files[n] : "multi-line quotes", same ? "same" : "DIFFERENT");
+  }
+}
+
+    printf("\n\n-- Test file sources give the same output as a buffer ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const std::string expected = record_parse(buffer, false, false, '#', true);
+
+    // mapped, with cells straight out of the mapping
+    record_builder mapped;
+    {
+      cppcsv::csv_parser<record_builder,std::string,std::string,char> cp(
+            mapped, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+      cp.set_zero_copy(true);
+      if (cppcsv::parse_file(cp, *fn))
+        mapped.events += std::string("ERROR: ") + cp.error() + "\n";
+    }
+
+    // read in tiny blocks from an open FILE
+    record_builder read;
+    {
+      FILE* fp = fopen(*fn, "rb");
+      assert(fp);
+      cppcsv::file_source in(fp, 5);
+      cppcsv::csv_parser<record_builder,std::string,std::string,char> cp(
+            read, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+      if (cppcsv::parse_source(cp, in))
+        read.events += std::string("ERROR: ") + cp.error() + "\n";
+      fclose(fp);
+    }
+
+    printf("%s: %s\n", *fn, (mapped.events == expected && read.events == expected) ? "same" : "DIFFERENT");
+  }
+#ifndef _WIN32
+  {
+    // a named pipe is read from the one open, the writer never sees it closed
+    std::string input;
+    for (int i = 0; i != 2000; ++i)
+      input += "a,\"b\",c\n";
+    const char* const fifo = "test_fifo.tmp";
+    unlink(fifo);
+    if (mkfifo(fifo, 0600) != 0)
+      printf("could not make %s\n", fifo);
+    else
+    {
+      boost::thread writer(write_file, fifo, &input);
+      record_builder read;
+      record_builder expected;
+      {
+        cppcsv::file_source in(fifo);
+        cppcsv::csv_parser<record_builder> cp(read, '"', ',');
+        if (cppcsv::parse_source(cp, in))
+          read.events += std::string("ERROR: ") + cp.error() + "\n";
+        cppcsv::csv_parser<record_builder> ep(expected, '"', ',');
+        ep(input);
+        ep.flush();
+        printf("fifo: %s, %s\n", in.is_mapped() ? "MAPPED" : "read", read.events == expected.events ? "same" : "DIFFERENT");
+      }
+      writer.join();
+      unlink(fifo);
+    }
+  }
+#endif
+
+    printf("\n\n-- Test csv_reader gives the same rows as csv_parser ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const char* data = buffer.empty() ? NULL : &buffer[0];
+
+    typedef cppcsv::csv_dialect<std::string,std::string,char> Dialect;
+    Dialect dialect("\"'", ",;\t", false, false, '#', true, true);
+
+    record_row_builder seq;
+    cppcsv::csv_parser<record_row_builder,std::string,std::string,char> cp(seq, dialect);
+    const char* cursor = data;
+    if (!cp(cursor, buffer.size()))
+      cp.flush();
+    if (cp.error())
+      seq.events += std::string("ERROR: ") + cp.error() + "\n" + cp.error_context() + "\n";
+
+    bool same = true;
+    for (size_t block = 0; block < 20; block += 3)
+    {
+      cppcsv::memory_source in(data, buffer.size(), block % 10);
+      cppcsv::csv_reader<std::string,std::string,char> reader(in, dialect, block < 10 ? 5 : 0);   // slices, then whole blocks
+      std::string events;
+      cppcsv::row_view row;
+      while (reader.next_row(row))
+      {
+        char num[32];
+        sprintf(num, "%llu<", (unsigned long long)row.file_row);
+        events += num;
+        for (size_t i = 0; i != row.size(); ++i) {
+          events += "[";
+          if (row[i].data)
+            events.append(row[i].data, row[i].len);
+          events += "]";
+        }
+        events += ">\n";
+      }
+      if (reader.error())
+        events += std::string("ERROR: ") + reader.error() + "\n" + reader.error_context() + "\n";
+      same = same && events == seq.events;
+    }
+    printf("%s: %s\n", *fn, same ? "same" : "DIFFERENT");
+  }
+  {
+    // one big block (like a mapped file) is still read a slice at a time
+    std::string input;
+    for (int i = 0; i != 100000; ++i)
+      input += "1,22,333\n";
+    cppcsv::memory_source in(input.data(), input.size());
+    cppcsv::csv_reader<> reader(in, cppcsv::csv_dialect<char,char,char>('"', ','));
+    cppcsv::row_view row;
+    size_t num_rows = 0;
+    size_t parsed_at_first = 0;
+    while (reader.next_row(row))
+      if (num_rows++ == 0)
+        parsed_at_first = reader.get_current_row();
+    printf("%lu rows, %s parsed for the first one\n", (unsigned long)num_rows,
+        parsed_at_first <= cppcsv::csv_reader<>::default_slice_bytes/9 + 1 ? "one slice" : "TOO MANY");
+  }
+
+    printf("\n\n-- Test count_rows agrees with csv_parser ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const char* data = buffer.empty() ? NULL : &buffer[0];
+
+    typedef cppcsv::csv_dialect<std::string,std::string,char> Dialect;
+    Dialect dialect("\"'", ",;\t", false, false, '#', true, true);
+
+    count_row_builder counted;
+    cppcsv::csv_parser<count_row_builder,std::string,std::string,char> cp(counted, dialect);
+    const char* cursor = data;
+    if (!cp(cursor, buffer.size()))
+      cp.flush();
+    const size_t expected = counted.rows;
+
+    bool same = true;
+    size_t rows = 0;
+    for (size_t block = 0; block < 10; block += 3)
+    {
+      cppcsv::memory_source in(data, buffer.size(), block);
+      const bool failed = cppcsv::count_rows(in, dialect, rows);
+      same = same && rows == expected && failed == (cp.error() != NULL);
+    }
+    printf("%s: %llu rows, %s\n", *fn, (unsigned long long)rows, same ? "same" : "DIFFERENT");
+  }
+
+    printf("\n\n-- Test csv_index, seek_row gives the rest of the rows ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const char* data = buffer.empty() ? NULL : &buffer[0];
+
+    typedef cppcsv::csv_dialect<std::string,std::string,char> Dialect;
+    Dialect dialect("\"'", ",;\t", false, false, '#', true, true);
+
+    record_row_builder all;
+    {
+      cppcsv::csv_parser<record_row_builder,std::string,std::string,char> cp(all, dialect);
+      cppcsv::memory_source in(data, buffer.size());
+      if (cppcsv::parse_source(cp, in))
+        all.events += "ERROR\n";
+    }
+
+    // an entry every 2 rows, saved and loaded again
+    cppcsv::csv_index index;
+    {
+      cppcsv::memory_source in(data, buffer.size(), 5);
+      cppcsv::csv_index built;
+      if (built.build(in, dialect, 2))
+        printf("build failed: ");
+      built.save("test_index.idx");
+      index.load("test_index.idx");
+      remove("test_index.idx");
+    }
+
+    bool same = true;
+    for (size_t row = 0; row <= index.rows(); ++row)
+    {
+      record_row_builder rest;
+      cppcsv::csv_parser<record_row_builder,std::string,std::string,char> cp(rest, dialect);
+      cppcsv::memory_source in(data, buffer.size(), 4);
+      if (cppcsv::seek_row(index, in, dialect, row, cp))
+      {
+        // only the row after the last can be missing, if there is no newline at the end
+        same = same && row == index.rows();
+        continue;
+      }
+      if (cppcsv::parse_source(cp, in))
+        rest.events += "ERROR\n";
+      same = same && all.events.size() >= rest.events.size()
+        && all.events.compare(all.events.size() - rest.events.size(), rest.events.size(), rest.events) == 0;
+    }
+
+    record_row_builder par;
+    cppcsv::parallel_csv_parser<record_row_builder,std::string,std::string,char> pp(par, dialect, 3);
+    pp.set_chunk_size(7);
+    if (pp.parse(data, buffer.size(), index))
+      par.events += "ERROR\n";
+    same = same && par.events == all.events;
+
+    printf("%s: %llu rows, %llu entries, %s\n", *fn, (unsigned long long)index.rows(),
+        (unsigned long long)index.get_entries().size(), same ? "same" : "DIFFERENT");
+  }
+
+    printf("\n\n-- Test checkpoints, resuming at every byte gives the same rows ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const char* data = buffer.empty() ? NULL : &buffer[0];
+
+    typedef cppcsv::csv_dialect<std::string,std::string,char> Dialect;
+    Dialect dialect("\"'", ",;\t", false, false, '#', true, true);
+
+    const std::string whole = parse_all<record_builder>(dialect, data, buffer.size())
+      + parse_all<record_row_builder>(dialect, data, buffer.size())
+      + parse_all<record_span_builder>(dialect, data, buffer.size());
+
+    bool same = true;
+    for (size_t split = 0; split <= buffer.size(); ++split)
+    {
+      const std::string resumed = parse_resumed<record_builder>(dialect, data, buffer.size(), split)
+        + parse_resumed<record_row_builder>(dialect, data, buffer.size(), split)
+        + parse_resumed<record_span_builder>(dialect, data, buffer.size(), split);
+      same = same && resumed == whole;
+    }
+
+    // a parser that reads the bytes differently does not take it
+    record_builder b1, b2;
+    cppcsv::csv_parser<record_builder,std::string,std::string,char> cp(b1, dialect);
+    cppcsv::csv_checkpoint cp_state;
+    cp.get_checkpoint(cp_state);
+    cppcsv::csv_parser<record_builder,std::string,std::string,char> other(b2, Dialect("\"", ",", false, false, '#'));
+    const bool refused = other.restore_checkpoint(cp_state);
+
+    printf("%s: %s, other dialect %s\n", *fn, same ? "same" : "DIFFERENT", refused ? "refused" : "ACCEPTED");
+  }
+
+    printf("\n\n-- Test compile-time dialects give the same output as runtime ones ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const char* data = buffer.empty() ? NULL : &buffer[0];
+
+    bool same = true;
+    for (int trim = 0; trim != 2; ++trim)
+    {
+      same = same
+        && record_fixed<cppcsv::Quote<'"'>,cppcsv::Sep<','>,cppcsv::Comment<'#'> >(data, buffer.size(), '"', ',', '#', trim != 0)
+        && record_fixed<cppcsv::Quote<'\''>,cppcsv::Sep<';'>,cppcsv::Disable>(data, buffer.size(), '\'', ';', 0, trim != 0)
+        && record_fixed<cppcsv::Disable,cppcsv::Sep<'\t'>,cppcsv::Comment<'#'> >(data, buffer.size(), 0, '\t', '#', trim != 0)
+        && record_fixed<cppcsv::Disable,cppcsv::Separator_Comma,cppcsv::Disable>(data, buffer.size(), 0, ',', 0, trim != 0);
+    }
+    printf("%s: %s\n", *fn, same ? "same" : "DIFFERENT");
+  }
+
+    printf("\n\n-- Test multi-char separators ---\n\n");
+
+  {
+    const char* const inputs[][2] = {
+      { "||", "id||name||note\n1||\"a||b\"||c|d\n2|||x||\n#3||skipped\n||\n" },
+      { "~|~", "a~|~b~|c~|~~|~d\n\"x~|~y\" ~|~ z~\n~|~\n" },
+      { NULL, NULL }
+    };
+    for (size_t i = 0; inputs[i][0]; ++i)
+    {
+      const std::string input = inputs[i][1];
+      const cppcsv::Separator_Token sep(inputs[i][0]);
+
+      std::string whole;
+      for (size_t chunk = 1; chunk <= input.size(); ++chunk)
+      {
+        record_builder rec;
+        cppcsv::csv_parser<record_builder,char,cppcsv::Separator_Token,char> cp(rec, '"', sep, true, false, '#', true);
+        cp.set_zero_copy(chunk % 2 == 0);
+        bool failed = false;
+        for (size_t pos = 0; pos < input.size() && !failed; pos += chunk)
+        {
+          const char* cursor = input.data() + pos;
+          failed = cp(cursor, std::min(chunk, input.size() - pos));
+        }
+        if (!failed)
+          cp.flush();
+        if (cp.error())
+          rec.events += std::string("ERROR: ") + cp.error() + "\n";
+        if (chunk == 1)
+          whole = rec.events;
+        else if (rec.events != whole)
+          printf("DIFFERENT with chunks of %d\n", (int)chunk);
+      }
+      printf("separator %s:\n%s", inputs[i][0], whole.c_str());
+    }
+  }
+
+    printf("\n\n-- Test memory limits ---\n\n");
+
+  {
+    const char* const inputs[] = {
+      "a,b,c\nshort,\"quoted\",x\n",
+      "a,b,c\n1,toolongcell,2\n",
+      "a,b,c\n1,\"too long\"\"quoted\",2\n",
+      "a,b,c\n123456,123456,123456,123456\n",
+      NULL
+    };
+    for (size_t i = 0; inputs[i]; ++i)
+    {
+      const std::string input = inputs[i];
+      std::string whole;
+      for (int mode = 0; mode != 4; ++mode)
+      {
+        const size_t chunk = (mode & 1) ? 1 : input.size();
+        record_builder rec;
+        cppcsv::csv_parser<record_builder> cp(rec, '"', ',');
+        cp.set_limits(8, 20);
+        cp.set_zero_copy((mode & 2) != 0);
+        bool failed = false;
+        for (size_t pos = 0; pos < input.size() && !failed; pos += chunk)
+        {
+          const char* cursor = input.data() + pos;
+          failed = cp(cursor, std::min(chunk, input.size() - pos));
+        }
+        if (!failed)
+          cp.flush();
+        if (cp.error())
+          rec.events += std::string("ERROR: ") + cp.error() + "\n";
+        if (mode == 0)
+          whole = rec.events;
+        else if (rec.events != whole)
+          printf("DIFFERENT in mode %d\n", mode);
+      }
+      printf("%s", whole.c_str());
+    }
+
+    // a huge row, then small ones: the buffers go back to their starting size
+    std::string input = "a," + std::string(1000000, 'x') + "\n";
+    for (int i = 0; i != 10; ++i)
+      input += "1,2\n";
+    record_row_builder rec;
+    cppcsv::csv_parser<record_row_builder> cp(rec, '"', ',');
+    cp.set_shrink_policy(4096, 5);
+    const size_t initial = cp.buffer_capacity();
+    const char* cursor = input.data();
+    const size_t big_row = input.find('\n') + 1;
+    cp(cursor, big_row);
+    const size_t after_big = cp.buffer_capacity();
+    cursor = input.data() + big_row;
+    cp(cursor, input.size() - big_row);
+    cp.flush();
+    printf("buffers: %s after the big row, %s after small rows\n",
+        after_big > 1000000 ? "grown" : "NOT GROWN",
+        cp.buffer_capacity() <= initial + 1024 ? "shrunk" : "NOT SHRUNK");
+  }
+  {
+    // the row that was over the limit is still open, more input and flush() keep the error
+    for (int mode = 0; mode != 2; ++mode)
+    {
+      record_builder rec;
+      cppcsv::csv_parser<record_builder> cp(rec, '"', ',');
+      cp.set_limits(4, 0);
+      cp.set_zero_copy(mode != 0);
+      const bool failed = cp.process_chunk("a,b\nc,abcdefghij\n");
+      const bool failed_again = cp.process_chunk("x,y\n");
+      const bool flush_failed = cp.flush();
+      printf("after a limit error%s: %s %s %s, %s\n", mode ? " (zero copy)" : "",
+          failed ? "failed" : "ok", failed_again ? "failed" : "ok", flush_failed ? "failed" : "ok", cp.error());
+    }
+    record_builder rec;
+    cppcsv::csv_parser<record_builder> cp(rec, '"', ',');
+    cp.set_limits(4, 0);
+    cp.process_chunk("a,b\nc,abcdef");
+    const bool flush_failed = cp.flush();
+    printf("limit error in flush(): %s, %s\n", flush_failed ? "failed" : "ok", cp.error());
+    cp.reset();
+    rec.events.clear();
+    cp.process_chunk("x,y\n");
+    printf("after reset(): %s", rec.events.c_str());
+  }
+
+    printf("\n\n-- Test reset() gives the same rows as a new parser ---\n\n");
+
+  {
+    const char* const inputs[] = {
+      "a,b,c\n1,\"two\nlines\",3\n",
+      "x, \"y\" ,z\n# comment\n",
+      "bad,\"quote\"x,1\nnever,seen\n",
+      "no,newline,at,the end",
+      "\n\n,,\n",
+      NULL
+    };
+    record_builder reused_rec;
+    cppcsv::csv_parser<record_builder> reused(reused_rec, '"', ',', true, false, '#', true);
+    reused.set_zero_copy(true);
+    size_t capacity = 0;
+    for (int pass = 0; pass != 2; ++pass)
+    {
+      for (size_t i = 0; inputs[i]; ++i)
+      {
+        const std::string input = inputs[i];
+
+        record_builder fresh_rec;
+        cppcsv::csv_parser<record_builder> fresh(fresh_rec, '"', ',', true, false, '#', true);
+        fresh.set_zero_copy(true);
+        const char* cursor = input.data();
+        if (fresh(cursor, input.size()) || fresh.flush())
+          fresh_rec.events += std::string("ERROR: ") + fresh.error() + "\n";
+
+        reused_rec.events.clear();
+        reused.reset();
+        cursor = input.data();
+        if (reused(cursor, input.size()) || reused.flush())
+          reused_rec.events += std::string("ERROR: ") + reused.error() + "\n";
+
+        if (pass == 0)
+          printf("%s", fresh_rec.events.c_str());
+        if (reused_rec.events != fresh_rec.events)
+          printf("DIFFERENT after reset\n");
+      }
+      if (pass == 0)
+        capacity = reused.buffer_capacity();
+    }
+    printf("buffers %s on the second pass\n", reused.buffer_capacity() == capacity ? "reused" : "REALLOCATED");
+  }
+
+    printf("\n\n-- Test prefetch_source gives the same rows ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const char* data = buffer.empty() ? NULL : &buffer[0];
+    const std::string expected = record_parse(buffer, false, false, '#', true);
+
+    bool same = true;
+    for (size_t block = 1; block < 40; block += 13)
+    {
+      cppcsv::memory_source mem(data, buffer.size(), 5);
+      cppcsv::prefetch_source in(mem, 2, block, 64);
+      record_builder rec;
+      cppcsv::csv_parser<record_builder,std::string,std::string,char> cp(
+            rec, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+      cp.set_zero_copy(true);
+      if (cppcsv::parse_source(cp, in))
+        rec.events += std::string("ERROR: ") + cp.error() + "\n";
+      else
+        same = same && in.position() == buffer.size();
+      same = same && rec.events == expected;
+    }
+
+    // seeking drops what was read ahead
+    cppcsv::memory_source mem(data, buffer.size(), 3);
+    cppcsv::prefetch_source in(mem, 3, 8, 8);
+    const char* block;
+    in.next(block);
+    const size_t offset = buffer.size() / 2;
+    std::string rest;
+    if (in.seek(offset))
+      while (size_t n = in.next(block))
+        rest.append(block, n);
+    same = same && rest == std::string(buffer.begin() + offset, buffer.end());
+
+    printf("%s: %s\n", *fn, same ? "same" : "DIFFERENT");
+  }
+
+  {
+    // errors on the reader thread come out of next()
+    class failing_source : public cppcsv::input_source {
+    public:
+      size_t next( const char*& data ) {
+        if (++calls > 3)
+          throw std::runtime_error("disk on fire");
+        data = "a,b\n";
+        return 4;
+      }
+      boost::uint64_t position() const { return 0; }
+      boost::uint64_t size() const { return 0; }
+      failing_source() : calls(0) {}
+      int calls;
+    };
+    failing_source failing;
+    cppcsv::prefetch_source in(failing, 2, 2);
+    record_builder rec;
+    cppcsv::csv_parser<record_builder> cp(rec, '"', ',');
+    try {
+      cppcsv::parse_source(cp, in);
+      printf("no error\n");
+    }
+    catch (std::runtime_error const& e) {
+      printf("%s%s\n", rec.events.c_str(), e.what());
+    }
+  }
+
+#ifdef __linux__
+    printf("\n\n-- Test direct_file_source gives the same rows ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const std::string expected = record_parse(buffer, false, false, '#', true);
+
+    bool same = true;
+    for (size_t depth = 1; depth != 4; ++depth)
+    {
+      // these files fit in one (4KB) block, the seek starts part way into it
+      cppcsv::direct_file_source in(*fn, 1, depth);
+      record_builder rec;
+      cppcsv::csv_parser<record_builder,std::string,std::string,char> cp(
+            rec, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+      cp.set_zero_copy(true);
+      if (cppcsv::parse_source(cp, in))
+        rec.events += std::string("ERROR: ") + cp.error() + "\n";
+      same = same && rec.events == expected;
+
+      const size_t offset = buffer.size() / 3;
+      std::string rest;
+      const char* block;
+      if (in.seek(offset))
+        while (size_t n = in.next(block))
+          rest.append(block, n);
+      same = same && rest == std::string(buffer.begin() + offset, buffer.end());
+    }
+    printf("%s: %s\n", *fn, same ? "same" : "DIFFERENT");
+  }
+
+  {
+    // the lowest free fd is the same after, so nothing was left open
+    const int free_fd = dup(0);
+    close(free_fd);
+    try {
+      cppcsv::direct_file_source in(".");
+      printf("directory: opened\n");
+    }
+    catch (std::runtime_error const& e) {
+      printf("directory: %s\n", e.what());
+    }
+    const int after = dup(0);
+    close(after);
+    printf("fd closed: %s\n", after == free_fd ? "yes" : "NO");
+  }
+#endif
+
+    printf("\n\n-- Test parser stats, compiled out (see test_stats.cpp) ---\n\n");
+
+  {
+    record_builder rec;
+    cppcsv::csv_parser<record_builder> cp(rec, '"', ',');
+    cp.set_stats_sampling(1);
+    if (cp(std::string("a,b\n1,2\n")) || cp.flush())
+      printf("ERROR: %s\n", cp.error());
+    const cppcsv::csv_stats s = cp.stats();
+    printf("enabled %d: %d bytes %d rows\n", (int)s.enabled, (int)s.bytes, (int)s.rows);
+  }
+
+    printf("\n\n-- Test sniff_dialect ---\n\n");
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    print_sniffed(*fn, std::string(buffer.begin(), buffer.end()));
+  }
+  {
+    std::string numbers, semis, tabs, pipes, comments;
+    for (int i = 0; i != 50; ++i)
+    {
+      char line[200];
+      sprintf(line, "%d,%d.5,x%d\n", i, i*7, i % 3);
+      numbers += line;
+      sprintf(line, "\"name; %d\";%d,5;\"he said \"\"hi\"\"\"\r\n", i, i);
+      semis += line;
+      sprintf(line, "%d\t12:30:%02d\tsome text, with a comma\n", i, i);
+      tabs += line;
+      sprintf(line, "'a|%d'|b|c\n", i);
+      pipes += line;
+      sprintf(line, "%s%d, %d, %d\n", i % 10 ? "" : "# every tenth line is a comment\n", i, i, i);
+      comments += line;
+    }
+    print_sniffed("numbers", numbers);
+    print_sniffed("semicolons", semis);
+    print_sniffed("tabs", tabs);
+    print_sniffed("pipes", pipes);
+    print_sniffed("comments", comments);
+    print_sniffed("one column", "a\nb\nc\n");
+    print_sniffed("empty", "");
+
+    // only whole lines of a long input, the same from a source
+    std::string longer;
+    while (longer.size() < 300*1024)
+      longer += numbers;
+    cppcsv::sniffed_dialect d1, d2;
+    std::string sample;
+    cppcsv::memory_source in(longer.data(), longer.size(), 4096);
+    const bool failed = cppcsv::sniff_dialect(longer.data(), longer.size(), d1) || cppcsv::sniff_source(in, sample, d2);
+    printf("long input: %s, %s, rest of the source %s\n",
+        failed ? "ERROR" : "sniffed", d1.rows == d2.rows && d1.rows < 300*1024/10 && d1.sep == d2.sep ? "same rows" : "DIFFERENT",
+        in.position() == sample.size() ? "follows the sample" : "LOST");
+  }
+
+    printf("\n\n-- Test typed cells ---\n\n");
+
+  {
+    cppcsv::csv_schema schema;
+    schema.add(cppcsv::field_int64).add(cppcsv::field_double).add(cppcsv::field_bool).add(cppcsv::field_date).add(cppcsv::field_string);
+    typed_printer printer;
+    cppcsv::typed_builder<typed_printer> builder(schema, printer);
+    cppcsv::csv_parser<cppcsv::typed_builder<typed_printer> > cp(builder, '"', ',');
+    cp.set_zero_copy(true);
+    const std::string input =
+      "42,3.25,true,1970-01-02,text\n"
+      "-9223372036854775808,-1.5e-3,No,2000-02-29,\"quoted, text\"\n"
+      " 7 ,\" 0.1 \",1,1969-12-31\n"
+      ",,,,\n"
+      "9223372036854775808,1e400,maybe,2001-02-29,extra,cells\n"
+      "12x,1.2.3,,20-01-01\n"
+      "123456789012345678,0.30000000000000004,F,2024-12-31,end\n";
+    if (cp(input) || cp.flush())
+      printf("ERROR: %s\n", cp.error());
+
+    const char* const doubles[] = { "1", "-0", ".5", "5.", "1e22", "1e23", "123456789012345678901234567890", "4.9e-324", "inf", "1e", "+-1", "0x10", NULL };
+    for (size_t i = 0; doubles[i]; ++i)
+    {
+      double d = 0;
+      const cppcsv::field_error e = cppcsv::parse_double(doubles[i], strlen(doubles[i]), d);
+      printf("double '%s': %s", doubles[i], cppcsv::field_error_text(e));
+      if (!e)
+        printf(" %.17g %s strtod", d, d == strtod(doubles[i], NULL) ? "same as" : "NOT");
+      printf("\n");
+    }
+  }
+
+    printf("\n\n-- Test columnar_builder ---\n\n");
+
+  {
+    batch_rows batches;
+    batches.print = true;
+    cppcsv::columnar_builder<batch_rows> builder(batches, 3);
+    cppcsv::csv_parser<cppcsv::columnar_builder<batch_rows> > cp(builder, '"', ',');
+    cp.set_zero_copy(true);
+    if (cp("a,b\n1,,\"\"\n\n2,3\nx,y,z,w\n1\n2\n3\n") || cp.flush())
+      printf("ERROR: %s\n", cp.error());
+    builder.finish();
+    printf("%s", batches.out.c_str());
+  }
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const std::string input(buffer.begin(), buffer.end());
+
+    std::string expected;
+    cppcsv::csv_builder_span<span_rows> spans((span_rows(&expected)));
+    cppcsv::csv_parser<cppcsv::csv_builder_span<span_rows>,std::string,std::string,char> sp(
+          spans, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+    const bool failed = sp(input) || sp.flush();
+
+    bool same = true;
+    for (size_t rows = 1; rows != 5; ++rows)
+    {
+      batch_rows batches;
+      cppcsv::columnar_builder<batch_rows> builder(batches, rows);
+      cppcsv::csv_parser<cppcsv::columnar_builder<batch_rows>,std::string,std::string,char> cp(
+            builder, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+      cp.set_zero_copy(true);
+      same = same && (cp(input) || cp.flush()) == failed;
+      builder.finish();
+      same = same && without_trailing_nulls(batches.out) == without_trailing_nulls(expected);
+    }
+    printf("%s: %s\n", *fn, same ? "same" : "DIFFERENT");
+  }
+
+  printf("\n\n-- Test per_batch_tag ---\n\n");
+  {
+    record_batch_builder out;
+    cppcsv::csv_parser<record_batch_builder> cp(out, '"', ',');
+    cp.set_batch_size(2, 1024*1024);
+    if (cp("a,b\nc,\"d\n\"\n\ne,f,g\n") || cp.flush())
+      printf("ERROR: %s\n", cp.error());
+    printf("%lu batches\n%s", (unsigned long)out.batches, out.events.c_str());
+  }
+  {
+    // the batches taken by the builder are the parser's buffers, not copies,
+    // and stay as they were while the parser carries on with new ones
+    record_batch_builder out(true);
+    cppcsv::csv_parser<record_batch_builder> cp(out, '"', ',');
+    cp.set_batch_size(100, 0);
+    std::string input;
+    for (int i = 0; i != 1000; ++i)
+      input += "12345,\"ab\"\"c\",,x\n";
+    if (cp(input) || cp.flush())
+      printf("ERROR: %s\n", cp.error());
+    record_row_builder expected;
+    cppcsv::csv_parser<record_row_builder> rp(expected, '"', ',');
+    if (rp(input) || rp.flush())
+      printf("ERROR: %s\n", rp.error());
+    const std::string all = out.kept_events();
+    printf("%lu batches of 100 rows, %s, first: %s", (unsigned long)out.batches,
+        all == expected.events ? "same" : "DIFFERENT", all.substr(0, all.find('\n') + 1).c_str());
+  }
+
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const std::string input(buffer.begin(), buffer.end());
+
+    record_row_builder expected;
+    cppcsv::csv_parser<record_row_builder,std::string,std::string,char> rp(
+          expected, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+    const bool failed = rp(input) || rp.flush();
+
+    bool same = true;
+    for (size_t rows = 1; rows != 7; ++rows)
+    {
+      for (size_t chunk = 1; chunk < input.size() + 7; chunk += 7)
+      {
+        for (int keep = 0; keep != 2; ++keep)
+        {
+          record_batch_builder out(keep != 0);
+          cppcsv::csv_parser<record_batch_builder,std::string,std::string,char> cp(
+                out, std::string("\"'"), std::string(",;\t"), false, false, '#', true);
+          // 5: a byte limit, 6: none, a batch per chunk
+          cp.set_batch_size(rows < 5 ? rows : 0, rows == 5 ? 1 : 0);
+          bool f = false;
+          for (size_t pos = 0; pos < input.size() && !f; pos += chunk)
+          {
+            const char* cursor = input.c_str() + pos;
+            f = cp(cursor, std::min(chunk, input.size() - pos));
+          }
+          f = f || cp.flush();
+          same = same && f == failed && (keep ? out.kept_events() : out.events) == expected.events;
+        }
+      }
+    }
+    printf("%s: %s\n", *fn, same ? "same" : "DIFFERENT");
+  }
+
+  printf("\n\n-- Test decompress_source ---\n\n");
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const std::string input(buffer.begin(), buffer.end());
+    cppcsv::memory_source plain(input.data(), input.size());
+    const std::string expected = source_rows(plain);
+
+    // one member, and two (split in the middle of a row)
+    const std::string one = gzip_string(input);
+    const std::string two = gzip_string(input.substr(0, input.size()/2)) + gzip_string(input.substr(input.size()/2));
+
+    bool same = true;
+    const size_t in_blocks[] = { 0, 1, 3, 100 };
+    const size_t out_blocks[] = { 1, 7, 65536 };
+    for (size_t i = 0; i != 4; ++i)
+    {
+      for (size_t o = 0; o != 3; ++o)
+      {
+        cppcsv::memory_source m1(one.data(), one.size(), in_blocks[i]);
+        cppcsv::decompress_source z1(m1, out_blocks[o]);
+        same = same && z1.format() == cppcsv::gzip_compression && source_rows(z1) == expected;
+        const char* rest;
+        while (z1.next(rest)) {}   // after a parse error
+        same = same && z1.position() == input.size() && z1.raw_position() == one.size();
+
+        cppcsv::memory_source m2(two.data(), two.size(), in_blocks[i]);
+        cppcsv::decompress_source z2(m2, out_blocks[o]);
+        same = same && source_rows(z2) == expected;
+
+        cppcsv::memory_source m3(input.data(), input.size(), in_blocks[i]);
+        cppcsv::decompress_source z3(m3, out_blocks[o]);
+        same = same && z3.format() == cppcsv::no_compression && source_rows(z3) == expected;
+      }
+    }
+
+    // on its own thread
+    cppcsv::memory_source m(two.data(), two.size(), 100);
+    cppcsv::decompress_source z(m, 7);
+    cppcsv::prefetch_source ahead(z, 3, 16);
+    same = same && source_rows(ahead) == expected;
+
+    printf("%s: %s (%s, %lu bytes)\n", *fn, same ? "same" : "DIFFERENT",
+          cppcsv::compression_name(z.format()), (unsigned long)input.size());
+  }
+
+  {
+    const std::string input = "a,b\nc,d\n";
+    const std::string gz = gzip_string(input);
+    const std::string truncated = gz.substr(0, gz.size() - 10);
+    std::string corrupt = gz;
+    corrupt[gz.size()/2] ^= 0x55;
+    const std::string garbage = gz + "xyz";
+    const std::string* bad[] = { &truncated, &corrupt, &garbage };
+    for (size_t i = 0; i != 3; ++i)
+    {
+      cppcsv::memory_source m(bad[i]->data(), bad[i]->size(), 3);
+      cppcsv::decompress_source z(m);
+      printf("%s", source_rows(z).c_str());
+    }
+
+    // shorter than a magic number
+    const char* tiny[] = { "", "x", "\x1f" };
+    for (size_t i = 0; i != 3; ++i)
+    {
+      cppcsv::memory_source m(tiny[i], strlen(tiny[i]), 1);
+      cppcsv::decompress_source z(m);
+      printf("%lu bytes: %s\n%s", (unsigned long)strlen(tiny[i]), cppcsv::compression_name(z.format()), source_rows(z).c_str());
+    }
+  }
+
+  printf("\n\n-- Test parallel_decompress_source ---\n\n");
+  for (const char* const* fn = all_test_files; *fn; ++fn)
+  {
+    std::vector<char> buffer;
+    read_file(*fn, buffer);
+    const std::string input(buffer.begin(), buffer.end());
+
+    typedef cppcsv::csv_dialect<std::string,std::string,char> Dialect;
+    Dialect dialect("\"'", ",;\t", false, false, '#', true, true);
+    cppcsv::memory_source plain(input.data(), input.size());
+    const std::string all = source_rows(plain);
+
+    const size_t third = input.size()/3;
+    const std::string kinds[] = {
+      bgzf_string(input, 16),
+      gzip_string(input.substr(0, third)) + gzip_string(input.substr(third, third)) + gzip_string(input.substr(2*third)),
+      gzip_string(input),
+      input
+    };
+    std::string report;
+    bool same = true;
+    for (size_t k = 0; k != 4; ++k)
+    {
+      std::string const& c = kinds[k];
+      for (unsigned threads = 1; threads <= 3; threads += 2)
+      {
+        for (size_t job_bytes = 1; job_bytes < 200; job_bytes *= 100)
+        {
+          cppcsv::parallel_decompress_source in(c.data(), c.size(), threads, job_bytes);
+          same = same && drain_source(in) == input && in.raw_position() == c.size();
+        }
+      }
+
+      // the block index is there from the start, or after reading it all (for the index)
+      cppcsv::parallel_decompress_source in(c.data(), c.size(), 3, 50);
+      char info[100];
+      sprintf(info, "%s%s %lu blocks%s", k ? ", " : "", cppcsv::compression_name(in.format()),
+          (unsigned long)in.get_blocks().size(), in.has_block_index() ? " indexed" : "");
+      report += info;
+      cppcsv::csv_index index;
+      index.build(in, dialect, 2);
+      drain_source(in);   // a parse error stops the index early
+      if (in.format() == cppcsv::no_compression)
+        same = same && in.size() == input.size();
+      else if (!in.is_parallel())
+        continue;   // can't seek
+      else
+        same = same && in.has_block_index() && in.size() == input.size();
+
+      for (size_t row = 0; row <= index.rows(); ++row)
+      {
+        record_row_builder rest;
+        cppcsv::csv_parser<record_row_builder,std::string,std::string,char> cp(rest, dialect);
+        if (cppcsv::seek_row(index, in, dialect, row, cp))
+        {
+          same = same && row == index.rows();
+          continue;
+        }
+        if (cppcsv::parse_source(cp, in))
+          rest.events += std::string("ERROR: ") + cp.error() + "\n";
+        same = same && all.size() >= rest.events.size()
+          && all.compare(all.size() - rest.events.size(), rest.events.size(), rest.events) == 0;
+      }
+    }
+    printf("%s: %s (%s)\n", *fn, same ? "same" : "DIFFERENT", report.c_str());
+  }
+
+  {
+    std::string input;
+    for (int i = 0; i != 1000; ++i)
+      input += "a,b,c\n";
+    std::string corrupt = bgzf_string(input, 100);
+    corrupt[corrupt.size() - 28 - 8] ^= 0x21;   // the crc of the last block, before the end of file one
+    const std::string members = gzip_string(input.substr(0, 3000)) + gzip_string(input.substr(3000));
+    const std::string truncated = members.substr(0, members.size() - 5);
+    const std::string trailing = members + "abc";
+    const std::string* bad[] = { &corrupt, &truncated, &trailing };
+    for (size_t i = 0; i != 3; ++i)
+    {
+      cppcsv::parallel_decompress_source in(bad[i]->data(), bad[i]->size(), 3, 100);
+      try {
+        drain_source(in);
+        printf("no error\n");
+      }
+      catch (std::runtime_error const& e) {
+        printf("after %llu bytes: %s\n", (unsigned long long)in.position(), e.what());
+      }
+    }
+  }
+
+  {
+    // every block is too big for a job, so seek() ends up on one thread
+    std::string input;
+    for (int i = 0; i != 1000; ++i)
+      input += (i % 7) ? "a,b,c\n" : "\"x\",y\n";
+    const std::string c = bgzf_string(input, 2000);
+    bool same = true;
+    cppcsv::parallel_decompress_source in(c.data(), c.size(), 3, 1, 1000);
+    same = same && in.has_block_index();
+    for (size_t offset = 0; offset <= input.size(); offset += 97)
+      same = same && in.seek(offset) && drain_source(in) == input.substr(offset) && in.position() == input.size();
+    printf("seek, blocks too big for a job: %s\n", same ? "same" : "DIFFERENT");
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+// csv_parser with the counters compiled in, see csvstats.hpp.
+// A program of its own, built with CPPCSV_STATS defined for all of it (see CMakeLists.txt),
+// so that test_csv covers the default build.
+#ifndef CPPCSV_STATS
+#  error build test_stats with CPPCSV_STATS defined
+#endif
+
+#include <cppcsv/csvparser.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+class null_builder : public cppcsv::per_cell_tag {
+public:
+  void begin_row() {}
+  void cell(const char *buf, size_t len) {}
+  void end_row() {}
+};
+
+// the counters after parsing input in chunks of chunk_len, as one line of text
+static std::string stats_parse( std::string const& input, size_t chunk_len )
+{
+  null_builder nb;
+  cppcsv::csv_parser<null_builder,char,char,char> cp(nb, '"', ',', false, false, '#', true);
+  for (size_t i = 0; i < input.size(); i += chunk_len)
+  {
+    const char* cursor = input.data() + i;
+    if (cp(cursor, std::min(chunk_len, input.size() - i)))
+      break;
+  }
+  cp.flush();
+  const cppcsv::csv_stats s = cp.stats();
+  char line[256];
+  sprintf(line, "bytes %d rows %d cells %d quoted %d escaped %d crlf %d comments %d max row %d cell %d%s",
+      (int)s.bytes, (int)s.rows, (int)s.cells, (int)s.quoted_cells, (int)s.escaped_quotes, (int)s.crlf_rows,
+      (int)s.comment_lines, (int)s.max_row_bytes, (int)s.max_cell_bytes, cp.error() ? " ERROR" : "");
+  return line;
+}
+
+int main(int argc,char **argv)
+{
+    printf("\n\n-- Test parser stats ---\n\n");
+
+  {
+    const std::string input =
+      "a,\"b\"\"c\",d\r\n"
+      "# a comment, \"not\" cells\n"
+      "\"x\",,\"yy\"\r\n"
+      "last,row";
+    const std::string expected = stats_parse(input, input.size());
+    printf("%s\n", expected.c_str());
+    bool same = true;
+    for (size_t chunk = 1; chunk != 8; ++chunk)
+      same = same && stats_parse(input, chunk) == expected;
+    printf("same for every chunk size: %s\n", same ? "yes" : "NO");
+
+    // one big cell grows the buffer
+    null_builder nb;
+    cppcsv::csv_parser<null_builder> cp(nb, '"', ',');
+    cp.set_stats_sampling(1);
+    const std::string big = "1," + std::string(1000, 'x') + "\n2,3\n";
+    if (cp(big) || cp.flush())
+      printf("ERROR: %s\n", cp.error());
+    cppcsv::csv_stats s = cp.stats();
+    printf("enabled %d rows %d max cell %d grew %s, timed %d rows: %s\n",
+        (int)s.enabled, (int)s.rows, (int)s.max_cell_bytes, s.buffer_growths ? "yes" : "no",
+        (int)s.sampled_rows, s.parse_ns && s.builder_ns <= s.parse_ns ? "ok" : "WRONG");
+
+    cp.reset();
+    s = cp.stats();
+    printf("after reset: %d bytes %d rows\n", (int)s.bytes, (int)s.rows);
+  }
+
+  return 0;
+}